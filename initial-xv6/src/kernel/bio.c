@@ -1,7 +1,11 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
+// The buffer cache is an array of buf structures holding
+// cached copies of disk block contents, hashed by block
+// number into buckets that each have their own lock. Block
+// data lives in pages taken from kalloc(): a share of free
+// memory at boot, more while memory is plentiful, and fewer
+// when kalloc() runs out.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
@@ -19,73 +23,337 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
 
-struct {
+// A buffer is found through the bucket its (dev, blockno)
+// hashes to, and that bucket's lock protects its list and
+// the refcnt and recent of the buffers on it, so lookups of
+// different blocks from several harts rarely contend.
+//
+// bcache.lock serializes recycling buffers for new blocks,
+// which moves a buffer from one bucket to another; it must
+// be acquired before any bucket lock, and a buffer's dev and
+// blockno change only while it is held, as does the set of
+// buffers that have data pages.
+//
+// Buffers to recycle are chosen by a clock: a hand sweeps the
+// slots, taking the first unused buffer that has not been
+// used since the hand last passed it and clearing the recent
+// bit of the others, so a miss looks at a few slots rather
+// than all of them.
+#define NBUCKET 1031
+#define BHASH(dev, blockno) (&bcache.bucket[((dev)*31 + (blockno)) % NBUCKET])
+#define BPP (PGSIZE/BSIZE)   // buffers per page of data
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;   // linked through b->next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;
+  struct buf buf[NBUFMAX];   // slots with data == 0 are unused
+  struct bucket bucket[NBUCKET];
+  int nbuf;                  // slots with data
+  int top;                   // slots at and above top have no data
+  int hand;                  // next slot the clock looks at
+  uint nfree;                // times a buffer's refcnt fell to 0
+  int stuck;                 // bshrink() found no page to free...
+  uint stuckfree;            // ...when nfree was this
+  int reserve;               // grow only while more pages are free
+  uint64 nhit, nmiss;
+  uint64 nahead, naheadused;  // blocks read ahead, and later read
 } bcache;
 
+// Add b to the bucket for its block.
+static void
+bhash(struct buf *b)
+{
+  struct bucket *bk = BHASH(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  b->next = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+}
+
+// Take b out of its bucket if no one is using it and it has
+// not been used since the clock hand last passed it; if it
+// has, clear that mark instead. Returns 1 if it was taken
+// out. Caller holds bcache.lock.
+static int
+bevict(struct buf *b)
+{
+  struct bucket *bk = BHASH(b->dev, b->blockno);
+  struct buf **pp;
+  int ok;
+
+  acquire(&bk->lock);
+  ok = (b->refcnt == 0 && !b->recent);
+  if(ok){
+    for(pp = &bk->head; *pp != b; pp = &(*pp)->next)
+      ;
+    *pp = b->next;
+  } else if(b->refcnt == 0) {
+    b->recent = 0;
+  }
+  release(&bk->lock);
+  return ok;
+}
+
+// Advance the clock hand by n slots, returning the slot it
+// pointed at. Caller holds bcache.lock.
+static struct buf*
+btick(int n)
+{
+  struct buf *b;
+
+  if(bcache.hand >= bcache.top)
+    bcache.hand = 0;
+  b = &bcache.buf[bcache.hand];
+  bcache.hand += n;
+  return b;
+}
+
+// Give the cache BPP more buffers, with their data in the
+// page pa. Returns 0 if pa is 0 or there are no free slots.
+// Caller holds bcache.lock.
+static int
+bgrow(char *pa)
+{
+  struct buf *b;
+  int i;
+
+  if(pa == 0)
+    return 0;
+  // Use the slots above top; look for a hole left by
+  // bshrink() only once those are gone.
+  if(bcache.top < NBUFMAX){
+    b = bcache.buf + bcache.top;
+  } else {
+    for(b = bcache.buf; b < bcache.buf+NBUFMAX; b += BPP){
+      if(b->data == 0)
+        break;
+    }
+    if(b == bcache.buf+NBUFMAX)
+      return 0;
+  }
+
+  // The new buffers hold no block yet; they sit in the
+  // bucket of dev 0, block 0 until recycled.
+  for(i = 0; i < BPP; i++){
+    b[i].data = (uchar*)pa + i*BSIZE;
+    b[i].dev = 0;
+    b[i].blockno = 0;
+    b[i].valid = 0;
+    b[i].refcnt = 0;
+    b[i].recent = 0;
+    bhash(&b[i]);
+  }
+  bcache.nbuf += BPP;
+  if(b + BPP > bcache.buf + bcache.top)
+    bcache.top = b + BPP - bcache.buf;
+  return 1;
+}
+
+// Return a page of buffer data to kalloc(), which calls
+// this when it runs out of memory. Returns 0 if the cache
+// is at its minimum size or every page has a buffer in use.
+int
+bshrink(void)
+{
+  struct buf *b;
+  char *pa;
+  int i, j, n;
+  uint nfree;
+
+  // kalloc() calls this every time it runs dry, so don't
+  // sweep again until some buffer has been released.
+  // Buffers are released under their bucket locks, not
+  // bcache.lock, so compare counts rather than clearing a
+  // flag: a release during the sweep below is not lost.
+  if(bcache.stuck && bcache.stuckfree == bcache.nfree)
+    return 0;
+  acquire(&bcache.lock);
+  if(bcache.nbuf - BPP < NBUF){
+    release(&bcache.lock);
+    return 0;
+  }
+  nfree = bcache.nfree;
+  __sync_synchronize();
+
+  // Sweep the clock a page at a time, for a page none of
+  // whose buffers is in use or recently used. Two turns
+  // clear every recent bit that is going to be cleared.
+  bcache.hand -= bcache.hand % BPP;
+  for(n = 0; n < 2 * bcache.top / BPP; n++){
+    b = btick(BPP);
+    if(b->data == 0)
+      continue;
+    for(i = 0; i < BPP; i++){
+      if(!bevict(&b[i]))
+        break;
+    }
+    if(i == BPP)
+      break;
+    for(j = 0; j < i; j++)   // some buffer is in use; put the rest back
+      bhash(&b[j]);
+  }
+  if(n == 2 * bcache.top / BPP){
+    bcache.stuck = 1;
+    bcache.stuckfree = nfree;
+    release(&bcache.lock);
+    return 0;
+  }
+  pa = (char*)b->data;
+  for(i = 0; i < BPP; i++)
+    b[i].data = 0;
+  bcache.nbuf -= BPP;
+  while(bcache.top > 0 && bcache.buf[bcache.top-1].data == 0)
+    bcache.top -= BPP;
+  release(&bcache.lock);
+
+  kfree(pa);
+  return 1;
+}
+
 void
 binit(void)
 {
+  struct bucket *bk;
   struct buf *b;
+  int n;
 
   initlock(&bcache.lock, "bcache");
-
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
+  for(b = bcache.buf; b < bcache.buf+NBUFMAX; b++)
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+
+  // Start with 1/BCACHEFRAC of free memory, and keep growing
+  // on misses while more than a quarter of it is still free.
+  n = kfreepages();
+  bcache.reserve = n / 4;
+  n = n / BCACHEFRAC * BPP;
+  if(n < NBUF)
+    n = NBUF;
+  if(n > NBUFMAX)
+    n = NBUFMAX;
+  while(bcache.nbuf < n && bgrow(kalloc()))
+    ;
+  if(bcache.nbuf < NBUF)
+    panic("binit");
+}
+
+// Find the cached buffer for block blockno on device dev in
+// bucket bk, and take a reference to it. Caller holds bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      return b;
+    }
   }
+  return 0;
 }
 
+static void bput(struct buf*);
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For read-ahead (ahead set), return 0 instead of a buffer
+// that is already cached.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
-  struct buf *b;
-
-  acquire(&bcache.lock);
+  struct bucket *bk = BHASH(dev, blockno);
+  struct buf *b, *lru;
+  char *pa;
+  int n;
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    if(ahead){
+      bput(b);
+      return 0;
     }
+    __sync_fetch_and_add(&bcache.nhit, 1);
+    acquiresleep(&b->lock);
+    return b;
   }
+  if(!ahead)
+    __sync_fetch_and_add(&bcache.nmiss, 1);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // While memory is plentiful, grow the cache rather than
+  // evict. kalloc() may call bshrink(), so call it before
+  // taking bcache.lock.
+  pa = 0;
+  if(bcache.nbuf < NBUFMAX && kfreepages() > bcache.reserve)
+    pa = kalloc();
+
+  // Look again once no one else can be caching blocks,
+  // in case another process read this one in meanwhile.
+  acquire(&bcache.lock);
+  if(pa && !bgrow(pa))
+    kfree(pa);
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    release(&bcache.lock);
+    if(ahead){
+      bput(b);
+      return 0;
     }
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Recycle the next unused buffer the clock finds, stealing
+  // it from whatever bucket it is in. If two turns of the
+  // clock find none, every buffer is in use.
+  for(n = 0; ; n++){
+    if(n >= 2 * bcache.top)
+      panic("bget: no buffers");
+    lru = btick(1);
+    if(lru->data && bevict(lru))
+      break;
   }
-  panic("bget: no buffers");
+
+  lru->dev = dev;
+  lru->blockno = blockno;
+  lru->valid = 0;
+  lru->ahead = 0;
+  lru->refcnt = 1;
+  bhash(lru);
+  release(&bcache.lock);
+
+  acquiresleep(&lru->lock);
+  return lru;
+}
+
+// Print the size and hit rate of the cache, for procdump.
+void
+bstat(void)
+{
+  uint64 n = bcache.nhit + bcache.nmiss;
+
+  printf("bcache: %d buffers, %d hits, %d misses, %d%% hit\n",
+         bcache.nbuf, (int)bcache.nhit, (int)bcache.nmiss,
+         n ? (int)(bcache.nhit * 100 / n) : 0);
+  printf("readahead: %d blocks, %d used\n",
+         (int)bcache.nahead, (int)bcache.naheadused);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,14 +362,70 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
+    if(myproc())
+      myproc()->nbread++;
+  } else if(b->ahead) {
+    b->ahead = 0;
+    __sync_fetch_and_add(&bcache.naheadused, 1);
   }
   return b;
 }
 
+// Return a locked buf for block blockno on device dev, filled
+// with zeros instead of read from disk; for a caller that is
+// about to overwrite the block's old contents.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  b->ahead = 0;
+  return b;
+}
+
+// Completion of a read-ahead, called from the disk
+// interrupt: the buffer is ready for bread().
+static void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  b->ahead = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Start reading block blockno on device dev into the cache,
+// without waiting for it; the read goes to the disk at the
+// next bkick(). Does nothing if the block is already cached
+// or the disk has no room for the request.
+void
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+
+  // Until the disk is done, the buffer is locked on its
+  // behalf; bdone() unlocks it and drops our reference.
+  disownsleep(&b->lock);
+  b->done = bdone;
+  if(b->valid || virtio_disk_start(b, 0, 1) < 0){
+    b->done = 0;
+    releasesleep(&b->lock);
+    bput(b);
+    return;
+  }
+  __sync_fetch_and_add(&bcache.nahead, 1);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,8 +435,49 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Drop a reference to b, and mark it recently used so that
+// the clock passes it over once.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = BHASH(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  b->refcnt--;
+  b->recent = 1;
+  if(b->refcnt == 0)
+    __sync_fetch_and_add(&bcache.nfree, 1);
+  release(&bk->lock);
+}
+
+// Start writing b's contents to disk, without waiting; the
+// write goes to the disk at the next bkick(), and bwait()
+// waits for it to finish. b must be locked until then.
+void
+bwrite_async(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_async");
+  b->done = 0;
+  virtio_disk_start(b, 1, 0);
+}
+
+// Wait for a bwrite_async() of b to finish.
+void
+bwait(struct buf *b)
+{
+  virtio_disk_wait(b);
+}
+
+// Send the requests queued by bread_async() and
+// bwrite_async() to the disk, all at once.
+void
+bkick(void)
+{
+  virtio_disk_kick();
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +485,25 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = BHASH(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = BHASH(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  if(b->refcnt == 0)
+    __sync_fetch_and_add(&bcache.nfree, 1);
+  release(&bk->lock);
 }
-
-
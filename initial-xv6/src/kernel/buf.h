@@ -1,12 +1,14 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ahead;   // read ahead, and not yet bread()?
+  void (*done)(struct buf*); // if set, the disk calls it when finished
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  uchar data[BSIZE];
+  int recent;       // used since the clock hand last passed?
+  struct buf *next; // hash bucket list
+  uchar *data;      // BSIZE bytes in a kalloc() page; 0 if unused
 };
 
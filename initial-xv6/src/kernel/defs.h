@@ -4,6 +4,8 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct rusage;
+struct rwlock;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -12,10 +14,17 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bread_async(uint, uint);
+void            bwrite_async(struct buf*);
+void            bwait(struct buf*);
+void            bkick(void);
+int             bshrink(void);
+void            bstat(void);
 
 // console.c
 void            consoleinit(void);
@@ -30,17 +39,21 @@ struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
-int             fileread(struct file*, uint64, int n);
+int             fileread(struct file*, int, uint64, int n);
 int             filestat(struct file*, uint64 addr);
-int             filewrite(struct file*, uint64, int n);
+int             filewrite(struct file*, int, uint64, int n);
+int             filesplice(struct file*, struct file*, int);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dcenter(struct inode*, char*, uint, uint);
+void            dcstat(void);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
+void            istat(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
@@ -61,20 +74,26 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+int             kfreepages(void);
 void            kfree(void *);
 void            kinit(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_data(struct buf*);
+void            log_free(int);
 void            begin_op(void);
+void            begin_opn(int);
+int             log_opmax(void);
+void            logstat(void);
 void            end_op(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -90,6 +109,7 @@ void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             kthread(char*, void (*)(void));
 int             killed(struct proc*);
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
@@ -106,6 +126,10 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             setdeadline(int, int);
+int             edfpreempt(void);
+int             setgang(void);
+int             schedstat(int, uint64);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -117,12 +141,25 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+#ifdef LOCKSTAT
+void            lockdump(void);
+#endif
+
+// rwlock.c
+void            acquireread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+int             holdingwrite(struct rwlock*);
+void            initrwlock(struct rwlock*, char*);
+void            releaseread(struct rwlock*);
+void            releasewrite(struct rwlock*);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            disownsleep(struct sleeplock*);
+extern uint64   nsleepspin, nsleepwait;
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -147,6 +184,10 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            updateticks(void);
+void            wheeladd(struct proc*, uint);
+void            wheeldel(struct proc*);
+void            timerset(void);
 
 // uart.c
 void            uartinit(void);
@@ -183,11 +224,13 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_start(struct buf *, int, int);
+void            virtio_disk_kick(void);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // waitx
-int             waitx(uint64, uint*, uint*);
-void            update_time(void);
+int             waitx(uint64, struct rusage*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -102,9 +102,10 @@ filestat(struct file *f, uint64 addr)
 }
 
 // Read from file f.
-// addr is a user virtual address.
+// addr is a user virtual address if user_dst is 1,
+// else a kernel address.
 int
-fileread(struct file *f, uint64 addr, int n)
+fileread(struct file *f, int user_dst, uint64 addr, int n)
 {
   int r = 0;
 
@@ -112,14 +113,14 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
   } else {
@@ -130,9 +131,10 @@ fileread(struct file *f, uint64 addr, int n)
 }
 
 // Write to file f.
-// addr is a user virtual address.
+// addr is a user virtual address if user_src is 1,
+// else a kernel address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+filewrite(struct file *f, int user_src, uint64 addr, int n)
 {
   int r, ret = 0;
 
@@ -140,28 +142,32 @@ filewrite(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
+    // i-node, two indirect blocks and the double-indirect
+    // block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int nblocks = log_opmax();
+    if(nblocks < MAXOPBLOCKS)
+      nblocks = MAXOPBLOCKS;
+    int max = ((nblocks-1-3-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_opn(nblocks);
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, user_src, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
@@ -180,3 +186,74 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Write n bytes from the kernel buffer buf to f, calling
+// filewrite() again while it takes only part. Returns how
+// many bytes went out, which is less than n after an error.
+static int
+splicewrite(struct file *f, char *buf, int n)
+{
+  int i, w;
+  uint off;
+
+  for(i = 0; i < n; i += w){
+    off = f->off;
+    if((w = filewrite(f, 0, (uint64)(buf + i), n - i)) <= 0){
+      // filewrite() fails a short write to an inode as a
+      // whole; the offset tells how much of it was written.
+      if(f->type == FD_INODE)
+        i += f->off - off;
+      break;
+    }
+  }
+  return i;
+}
+
+// Move up to n bytes from file fin to file fout, a page at
+// a time through a kernel buffer, so that the data never
+// crosses into user space. Like read(), stops early if fin
+// has less ready, or if fout takes less. Returns the number
+// of bytes moved, 0 at the end of fin, or -1 if an error
+// stopped it before it moved anything. Input that fout did
+// not take goes back to an inode by moving its offset back;
+// from a pipe or device it cannot, and is lost as it would
+// be after a read() and a failed write().
+int
+filesplice(struct file *fin, struct file *fout, int n)
+{
+  char *buf;
+  int r, w, m, tot;
+
+  if(fin->readable == 0 || fout->writable == 0)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  for(tot = 0; tot < n; tot += w){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if((r = fileread(fin, 0, (uint64)buf, m)) <= 0){
+      if(r < 0 && tot == 0)
+        tot = -1;
+      break;
+    }
+    if((w = splicewrite(fout, buf, r)) < r){
+      if(fin->type == FD_INODE){
+        ilock(fin->ip);
+        fin->off -= r - w;
+        iunlock(fin->ip);
+      }
+      tot += w;
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+
+  kfree(buf);
+  return tot;
+}
@@ -18,6 +18,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // hash bucket list
+  int recent;         // released since the clock hand last passed?
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +28,15 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint ranext;        // block after the last one read
+  uint rawin;         // read-ahead window, in blocks; 0 if not sequential
+  uint raend;         // blocks before this have been read ahead
+  uint nextb;         // block to try first for the next balloc()
+  uint extlbn;        // cached extent: file blocks extlbn..extlbn+extlen-1
+  uint extpbn;        //   live at disk blocks extpbn..extpbn+extlen-1
+  uint extlen;
 };
 
 // map major device number to device functions.
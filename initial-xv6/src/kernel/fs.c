@@ -37,6 +37,8 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bsuminit(int);
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,41 +46,76 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
-// Zero a block.
+// Blocks.
+
+// In-memory summary of the free bitmap: how many blocks each
+// bitmap block has free, so that balloc() skips full ones
+// without reading them. nfree[i] changes only while bitmap
+// block i is locked, so a count read without that lock is
+// only a hint.
+#define NBMAP (FSSIZE/BPB + 1)
+struct {
+  int nbmap;          // bitmap blocks
+  int nfree[NBMAP];   // free blocks in each
+  uint rotor;         // where to look when there is no hint
+} bsum;
+
+// Count the free blocks, once the log has been recovered.
 static void
-bzero(int dev, int bno)
+bsuminit(int dev)
 {
   struct buf *bp;
-
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  log_write(bp);
-  brelse(bp);
+  int i, bi;
+
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap > NBMAP)
+    panic("bsuminit: file system too big");
+  for(i = 0; i < bsum.nbmap; i++){
+    bp = bread(dev, sb.bmapstart + i);
+    for(bi = 0; bi < BPB && i*BPB + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[i]++;
+    brelse(bp);
+  }
 }
 
-// Blocks.
-
-// Allocate a zeroed disk block.
+// Allocate a disk block, preferably block hint, or
+// else the first free one after it, so that a file's blocks
+// come out contiguous. A hint of 0 means none.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint hint)
 {
-  int b, bi, m;
+  int n, i, bi, first, m;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  if(hint == 0 || hint >= sb.size)
+    hint = bsum.rotor;
+
+  // Visit the hint's bitmap block first, then the rest,
+  // wrapping around to the start of the hint's block.
+  for(n = 0; n <= bsum.nbmap; n++){
+    i = (hint / BPB + n) % bsum.nbmap;
+    if(bsum.nfree[i] == 0)
+      continue;
+    first = (n == 0) ? hint % BPB : 0;
+    bp = bread(dev, sb.bmapstart + i);
+    for(bi = first; bi < BPB && i*BPB + bi < sb.size; bi++){
+      if(bi % 8 == 0 && bp->data[bi/8] == 0xff){
+        bi += 7;   // whole byte in use
+        continue;
+      }
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
+        bsum.nfree[i]--;
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        bsum.rotor = i*BPB + bi + 1;
+        return i*BPB + bi;
       }
     }
     brelse(bp);
@@ -100,8 +137,10 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  bsum.nfree[b / BPB]++;
   log_write(bp);
   brelse(bp);
+  log_free(b);
 }
 
 // Inodes.
@@ -130,17 +169,18 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   may be recycled for another inode if ip->ref is zero.
+//   Otherwise ip->ref tracks the number of in-memory
+//   pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry
+//   and increments its ref; iput() decrements ref.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if it frees the inode, and iget() if it
+//   recycles the entry.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,29 +204,120 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is sized at boot from free memory, and an entry
+// whose ref has dropped to zero keeps its inode, still valid,
+// until the entry is needed for another one; so inodes used
+// again soon need no disk read. Entries to recycle are chosen
+// by a clock, as in the buffer cache: a hand sweeps the table
+// and takes the first unreferenced entry not released since
+// the hand last passed it.
+//
+// An entry is found through the bucket its (dev, inum) hashes
+// to. That bucket's lock protects the bucket's list and the
+// ip->recent of its entries, and must be held to raise
+// ip->ref from zero or drop it to zero. ip->ref is changed
+// with atomic adds, so taking another reference to an inode
+// already held (idup), or dropping one that is not the last,
+// needs no lock at all.
+//
+// itable.lock serializes recycling entries for new inodes,
+// which moves an entry from one bucket to another; it must be
+// acquired before any bucket lock, and an entry's dev and inum
+// change only while it is held.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum, next and recent.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+#define NIBUCKET 257
+#define IHASH(dev, inum) (&itable.bucket[((dev)*31 + (inum)) % NIBUCKET])
+#define IPP (PGSIZE/sizeof(struct inode))   // entries per page
+
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;   // linked through ip->next
+};
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *inode[NINODEMAX];
+  struct ibucket bucket[NIBUCKET];
+  int ninode;
+  int hand;             // next entry the clock looks at
+  uint64 nhit, nmiss;
 } itable;
 
+static void dcinit(void);
+static void dcpurge(struct inode*);
+
+// Add ip to the bucket for its inode.
+static void
+ihash(struct inode *ip)
+{
+  struct ibucket *bk = IHASH(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
+  ip->next = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
+}
+
+// Take ip out of its bucket if no one is using it and it has
+// not been released since the clock hand last passed it; if
+// it has, clear that mark instead. Returns 1 if it was taken
+// out. Caller holds itable.lock.
+static int
+ievict(struct inode *ip)
+{
+  struct ibucket *bk = IHASH(ip->dev, ip->inum);
+  struct inode **pp;
+  int ok;
+
+  acquire(&bk->lock);
+  ok = (ip->ref == 0 && !ip->recent);
+  if(ok){
+    for(pp = &bk->head; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+  } else if(ip->ref == 0) {
+    ip->recent = 0;
+  }
+  release(&bk->lock);
+  return ok;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
+  struct ibucket *bk;
+  struct inode *ip;
+  char *pa;
+  int i, n;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  for(bk = itable.bucket; bk < itable.bucket+NIBUCKET; bk++)
+    initlock(&bk->lock, "itable.bucket");
+
+  // Take 1/ICACHEFRAC of free memory. Entries hold no inode
+  // yet; they sit in the bucket of dev 0, inum 0 until used.
+  n = kfreepages() / ICACHEFRAC * IPP;
+  if(n < NINODE)
+    n = NINODE;
+  if(n > NINODEMAX)
+    n = NINODEMAX;
+  while(itable.ninode < n){
+    if((pa = kalloc()) == 0)
+      break;
+    memset(pa, 0, PGSIZE);
+    for(i = 0; i < IPP && itable.ninode < NINODEMAX; i++){
+      ip = (struct inode*)pa + i;
+      initsleeplock(&ip->lock, "inode");
+      itable.inode[itable.ninode++] = ip;
+      ihash(ip);
+    }
   }
+  if(itable.ninode < NINODE)
+    panic("iinit");
+  dcinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -243,47 +374,94 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Find the entry for inode inum on device dev in bucket bk,
+// and take a reference to it. Caller holds bk->lock.
 static struct inode*
-iget(uint dev, uint inum)
+ifind(struct ibucket *bk, uint dev, uint inum)
 {
-  struct inode *ip, *empty;
-
-  acquire(&itable.lock);
+  struct inode *ip;
 
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
+  for(ip = bk->head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      __sync_fetch_and_add(&ip->ref, 1);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
+  return 0;
+}
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+static struct inode*
+iget(uint dev, uint inum)
+{
+  struct ibucket *bk = IHASH(dev, inum);
+  struct inode *ip;
+  int n;
+
+  // Is the inode already in the table?
+  acquire(&bk->lock);
+  ip = ifind(bk, dev, inum);
+  release(&bk->lock);
+  if(ip){
+    __sync_fetch_and_add(&itable.nhit, 1);
+    return ip;
+  }
+  __sync_fetch_and_add(&itable.nmiss, 1);
+
+  // Not there; look again once no one else can be adding
+  // inodes, since another process may have added it in the
+  // meantime.
+  acquire(&itable.lock);
+  acquire(&bk->lock);
+  ip = ifind(bk, dev, inum);
+  release(&bk->lock);
+  if(ip){
+    release(&itable.lock);
+    return ip;
+  }
+
+  // Recycle the next unreferenced entry the clock finds.
+  // If two turns of the clock find none, every entry is
+  // in use.
+  for(n = 0; ; n++){
+    if(n >= 2 * itable.ninode)
+      panic("iget: no inodes");
+    ip = itable.inode[itable.hand];
+    itable.hand = (itable.hand + 1) % itable.ninode;
+    if(ievict(ip))
+      break;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = ip->rawin = ip->raend = 0;
+  ip->nextb = 0;
+  ip->extlen = 0;
+  ihash(ip);
   release(&itable.lock);
 
   return ip;
 }
 
+// Print the size and hit rate of the inode table, for procdump.
+void
+istat(void)
+{
+  uint64 n = itable.nhit + itable.nmiss;
+
+  printf("itable: %d inodes, %d hits, %d misses, %d%% hit\n",
+         itable.ninode, (int)itable.nhit, (int)itable.nmiss,
+         n ? (int)(itable.nhit * 100 / n) : 0);
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
-  ip->ref++;
-  release(&itable.lock);
+  // The caller's reference keeps ip in the table.
+  __sync_fetch_and_add(&ip->ref, 1);
   return ip;
 }
 
@@ -336,7 +514,18 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk;
+  int r;
+
+  // Dropping a reference that is not the last can neither
+  // free the entry nor the inode, so needs no lock.
+  while((r = ip->ref) > 1){
+    if(__sync_bool_compare_and_swap(&ip->ref, r, r - 1))
+      return;
+  }
+
+  bk = IHASH(ip->dev, ip->inum);
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,8 +534,10 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&bk->lock);
 
+    if(ip->type == T_DIR)
+      dcpurge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -354,11 +545,12 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
   }
 
-  ip->ref--;
-  release(&itable.lock);
+  if(__sync_sub_and_fetch(&ip->ref, 1) == 0)
+    ip->recent = 1;
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -374,7 +566,83 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the NDINDIRECT after
+// that in the indirect blocks listed in block ip->addrs[NDIRECT+1].
+// Files are mostly laid out contiguously (see iballoc), so bmap
+// keeps the last run of consecutive blocks it found, an extent,
+// in ip->extlbn/extpbn/extlen.
+
+// Record a change to block bp of ip's content. A regular
+// file's data is written in place before the transaction
+// commits (see log_data); directories and indirect blocks
+// go through the log.
+static void
+idirty(struct inode *ip, struct buf *bp, int data)
+{
+  if(data && ip->type == T_FILE)
+    log_data(bp);
+  else
+    log_write(bp);
+}
+
+// Allocate a zeroed block for ip, next to the last one
+// allocated. data says whether it will hold file content
+// rather than block numbers.
+static uint
+iballoc(struct inode *ip, int data)
+{
+  uint addr;
+  struct buf *bp;
+
+  if((addr = balloc(ip->dev, ip->nextb)) == 0)
+    return 0;
+  ip->nextb = addr + 1;
+  bp = bnew(ip->dev, addr);
+  idirty(ip, bp, data);
+  brelse(bp);
+  return addr;
+}
+
+// Remember the run of contiguous disk blocks that starts at a[0],
+// the address of block lbn, so that sequential bmap() calls can
+// skip the indirect blocks. a[] holds n valid entries.
+static void
+extcache(struct inode *ip, uint lbn, uint *a, int n)
+{
+  int len;
+
+  for(len = 1; len < n && a[len] == a[0] + len; len++)
+    ;
+  ip->extlbn = lbn;
+  ip->extpbn = a[0];
+  ip->extlen = len;
+}
+
+// Look up (and allocate if needed) entry bn of indirect block addr.
+// If the entry already existed, cache the extent that starts there.
+static uint
+bmapind(struct inode *ip, uint addr, uint bn, uint lbn)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[bn]) == 0){
+    addr = iballoc(ip, 1);
+    if(addr){
+      a[bn] = addr;
+      log_write(bp);
+      if(ip->extlen && lbn == ip->extlbn + ip->extlen &&
+         addr == ip->extpbn + ip->extlen)
+        ip->extlen++;
+    }
+  } else {
+    extcache(ip, lbn, a + bn, NINDIRECT - bn);
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -382,12 +650,17 @@ iunlockput(struct inode *ip)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, lbn;
+  uint *a;
   struct buf *bp;
 
+  lbn = bn;
+  if(lbn - ip->extlbn < ip->extlen)
+    return ip->extpbn + (lbn - ip->extlbn);
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip, 1);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -399,27 +672,60 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip, 0);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
     }
+    return bmapind(ip, addr, bn, lbn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect block
+    // it points to, allocating either if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0){
+      addr = iballoc(ip, 0);
+      if(addr == 0)
+        return 0;
+      ip->addrs[NDIRECT+1] = addr;
+    }
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+    if((addr = a[bn / NINDIRECT]) == 0){
+      addr = iballoc(ip, 0);
       if(addr){
-        a[bn] = addr;
+        a[bn / NINDIRECT] = addr;
         log_write(bp);
       }
     }
     brelse(bp);
-    return addr;
+    if(addr == 0)
+      return 0;
+    return bmapind(ip, addr, bn % NINDIRECT, lbn);
   }
 
   panic("bmap: out of range");
 }
 
+// Free the data blocks listed in indirect block addr, then addr.
+static void
+ifreeind(struct inode *ip, uint addr)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j])
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
@@ -437,17 +743,23 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    ifreeind(ip, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        ifreeind(ip, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
   }
 
+  ip->extlen = 0;
   ip->size = 0;
   iupdate(ip);
 }
@@ -464,6 +776,47 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read-ahead window limits, in blocks.
+#define RAMIN 4
+#define RAMAX 64
+
+// Before a read of n bytes at off, if ip is being read
+// sequentially, start reading the blocks that follow into
+// the cache. The window doubles with each sequential read,
+// and is dropped by a seek.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn = off / BSIZE;
+  uint end = (off + n + BSIZE - 1) / BSIZE;
+  uint nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  uint addr;
+
+  // A read that starts in the block where the last one
+  // ended, or just after it, continues a sequential scan.
+  if(bn == ip->ranext || bn + 1 == ip->ranext){
+    ip->rawin = ip->rawin ? ip->rawin * 2 : RAMIN;
+    if(ip->rawin > RAMAX)
+      ip->rawin = RAMAX;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = end;
+  if(ip->rawin == 0)
+    return;
+
+  if(ip->raend < end)
+    ip->raend = end;
+  for(; ip->raend < end + ip->rawin && ip->raend < nblocks; ip->raend++){
+    if((addr = bmap(ip, ip->raend)) == 0)
+      break;
+    bread_async(ip->dev, addr);
+  }
+  bkick();
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -479,6 +832,9 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->type == T_FILE)
+    readahead(ip, off, n);
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
@@ -523,7 +879,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
-    log_write(bp);
+    idirty(ip, bp, 1);
     brelse(bp);
   }
 
@@ -546,6 +902,148 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache: remembers the result of recent
+// dirlookup()s, (directory, name) -> (inum, offset of the entry),
+// including names that were not found (inum 0), so repeated
+// path lookups need not scan the directory.
+// A directory's entries change only while the directory is
+// locked, and dirlookup() is only called with it locked, so the
+// cache stays exact as long as every change to a directory's
+// entries updates the cache too: dirlink() and sys_unlink()
+// call dcenter(), and freeing a directory forgets all its names.
+// Each bucket is a small set of entries with its own lock,
+// replaced least recently used first.
+#define NDCBUCKET 127
+#define DCWAYS 8
+
+struct dcent {
+  uint dev;
+  uint dinum;         // directory; 0 if the slot is free
+  uint inum;          // 0 if name is not in the directory
+  uint off;           // byte offset of the entry in the directory
+  uint64 lastuse;
+  char name[DIRSIZ];
+};
+
+struct {
+  struct {
+    struct spinlock lock;
+    struct dcent ent[DCWAYS];
+  } bucket[NDCBUCKET];
+  uint64 nhit, nmiss;
+} dcache;
+
+static void
+dcinit(void)
+{
+  int i;
+
+  for(i = 0; i < NDCBUCKET; i++)
+    initlock(&dcache.bucket[i].lock, "dcache");
+}
+
+static int
+dchash(struct inode *dp, char *name)
+{
+  uint h;
+  int i;
+
+  h = dp->dev * 31 + dp->inum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDCBUCKET;
+}
+
+// Look name up in directory dp in the cache.
+// Returns 1 and sets *inum (0 if there is no such entry)
+// and *off if the answer is cached, 0 otherwise.
+// Caller must hold dp->lock.
+static int
+dclookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  int h, i;
+  struct dcent *e;
+
+  h = dchash(dp, name);
+  acquire(&dcache.bucket[h].lock);
+  for(i = 0; i < DCWAYS; i++){
+    e = &dcache.bucket[h].ent[i];
+    if(e->dinum == dp->inum && e->dev == dp->dev &&
+       namecmp(e->name, name) == 0){
+      *inum = e->inum;
+      *off = e->off;
+      e->lastuse = r_time();
+      release(&dcache.bucket[h].lock);
+      __sync_fetch_and_add(&dcache.nhit, 1);
+      return 1;
+    }
+  }
+  release(&dcache.bucket[h].lock);
+  __sync_fetch_and_add(&dcache.nmiss, 1);
+  return 0;
+}
+
+// Record that name in directory dp is inum at offset off,
+// or is absent if inum is 0.
+// Caller must hold dp->lock.
+void
+dcenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  int h, i;
+  struct dcent *e, *lru;
+
+  h = dchash(dp, name);
+  acquire(&dcache.bucket[h].lock);
+  lru = 0;
+  for(i = 0; i < DCWAYS; i++){
+    e = &dcache.bucket[h].ent[i];
+    if(e->dinum == dp->inum && e->dev == dp->dev &&
+       namecmp(e->name, name) == 0){
+      lru = e;
+      break;
+    }
+    if(lru == 0 || e->lastuse < lru->lastuse)
+      lru = e;
+  }
+  lru->dev = dp->dev;
+  lru->dinum = dp->inum;
+  lru->inum = inum;
+  lru->off = off;
+  lru->lastuse = r_time();
+  strncpy(lru->name, name, DIRSIZ);
+  release(&dcache.bucket[h].lock);
+}
+
+// Forget every name cached for directory dp, which is
+// being freed, before its inode number can be reused.
+static void
+dcpurge(struct inode *dp)
+{
+  int h, i;
+  struct dcent *e;
+
+  for(h = 0; h < NDCBUCKET; h++){
+    acquire(&dcache.bucket[h].lock);
+    for(i = 0; i < DCWAYS; i++){
+      e = &dcache.bucket[h].ent[i];
+      if(e->dinum == dp->inum && e->dev == dp->dev)
+        e->dinum = 0;
+    }
+    release(&dcache.bucket[h].lock);
+  }
+}
+
+// Print the hit rate of the name cache, for procdump.
+void
+dcstat(void)
+{
+  uint64 n = dcache.nhit + dcache.nmiss;
+
+  printf("dcache: %d hits, %d misses, %d%% hit\n",
+         (int)dcache.nhit, (int)dcache.nmiss,
+         n ? (int)(dcache.nhit * 100 / n) : 0);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -557,6 +1055,14 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dclookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +1073,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -601,6 +1109,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcenter(dp, name, inum, off);
 
   return 0;
 }
@@ -21,6 +21,7 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;   // pages on freelist
 } kmem;
 
 struct {
@@ -101,12 +102,15 @@ kfree(void *pa)
   acquire(&kmem.lock);
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   release(&kmem.lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When memory runs out, takes pages back from the
+// buffer cache before giving up.
 void *
 kalloc(void)
 {
@@ -114,10 +118,15 @@ kalloc(void)
 
   acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r) 
+  if(r) {
     kmem.freelist = r->next;
+    kmem.nfree--;
+  }
   release(&kmem.lock);
 
+  if(r == 0 && bshrink())
+    return kalloc();
+
   if(r)
   {
     memset((char*)r, 5, PGSIZE); // fill with junk
@@ -130,3 +139,10 @@ kalloc(void)
   }
   return (void*)r;
 }
+
+// Number of free pages.
+int
+kfreepages(void)
+{
+  return kmem.nfree;
+}
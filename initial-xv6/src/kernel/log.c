@@ -6,6 +6,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -18,22 +19,54 @@
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// begin_op() reserves log space for MAXOPBLOCKS blocks;
+// a call that knows it writes more, or fewer, reserves
+// that many with begin_opn(). Each new block logged uses
+// up one of the call's reserved slots. If the log might
+// not have room for the reservation, begin_op() sleeps
+// until the last outstanding end_op() commits, or until
+// the checkpointer frees some log space.
+//
+// Commit writes the transaction's blocks to the log and
+// then the header, and new system calls wait only until
+// the header is on disk. Installing committed blocks at
+// their home locations ("checkpointing") is left to a
+// kernel thread, which runs once the log is half full or
+// someone is waiting for log space, and installs every
+// transaction committed so far in one batch. Committed
+// blocks stay pinned in the buffer cache until installed,
+// so reads never see the stale home copies. Installation
+// writes the copies in the log, not the cached blocks, so
+// later transactions' changes stay off the disk.
+//
+// Regular file data is not logged ("ordered" mode): log_data()
+// only pins the block, and commit writes it to its home
+// location in the same batch as the log blocks, so it is on
+// disk before any committed inode or indirect block points at
+// it, and is written once rather than twice. A block that is
+// still in the log, or that this transaction freed, is logged
+// as before: its home location may yet be overwritten by
+// installation or recovery, or still belong to a file that a
+// crash would bring back. make DATAJOURNAL=1 logs all data.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
+//   header block, containing n, start, and block #s for A, B, C, ...
+//   nlog-1 slots, used as a circular buffer: slot
+//   (start+i) % (nlog-1) holds the new contents of block[i].
+// The header lists the blocks of every transaction that has
+// committed but is not yet installed, oldest first, so
+// recovery replays them in commit order. The blocks of each
+// commit or checkpoint are written as one batch, and it
+// waits once for the whole batch.
+
+#define NFREED 64   // freed blocks listed per transaction
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  int start;   // slot of block[0]
   int block[LOGSIZE];
 };
 
@@ -41,15 +74,48 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int nslot;       // slots in the circular log
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int inuse;       // slots the next commit cannot use.
+  int reserved;    // slots reserved by FS sys calls and not yet used.
+  int ckwanted;    // someone is waiting for log space.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // transaction being built
+  struct logheader clh; // transaction being committed
+  struct logheader dh;  // committed, not installed; the on-disk header
+
+  // File data blocks of the transaction being built, written
+  // in place by commit(); and blocks it freed (nfreed >
+  // NFREED means too many to list).
+  int ndata;
+  int data[LOGSIZE];
+  int cdata[LOGSIZE];
+  int nfreed;
+  int freed[NFREED];
+
+  // Log blocks being written by commit(), and being
+  // installed by checkpoint() through buffers of its own.
+  struct buf *wbuf[LOGSIZE];
+  struct buf *dbuf[LOGSIZE];
+  struct buf *ibuf[LOGSIZE];
+  struct buf home[LOGSIZE];
+
+  // For logstat().
+  uint64 ncommit;   // commits
+  uint64 nblocks;   // blocks committed
+  uint64 ndatablocks; // data blocks written in place
+  int maxinuse;     // most slots in use at once
 };
 struct log log;
 
 static void recover_from_log(void);
+static int log_freed(int);
 static void commit();
+static void checkpointer(void);
+
+// Disk block number of log slot i.
+#define SLOT(i) (log.start + 1 + (i))
 
 void
 initlog(int dev, struct superblock *sb)
@@ -58,26 +124,58 @@ initlog(int dev, struct superblock *sb)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
+  for (int i = 0; i < LOGSIZE; i++)
+    initsleeplock(&log.home[i].lock, "loghome");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.nslot = log.size - 1;
+  if (log.nslot > LOGSIZE)
+    log.nslot = LOGSIZE;
   log.dev = dev;
   recover_from_log();
+  if (kthread("checkpoint", checkpointer) < 0)
+    panic("initlog: checkpointer");
 }
 
-// Copy committed blocks from log to their home location
+// Copy the oldest n committed blocks from the log to their
+// home locations, as one batch, then unpin them.
 static void
-install_trans(int recovering)
+install_trans(int n)
 {
-  int tail;
+  int i, j;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
+  for (i = 0; i < n; i++) {
+    struct buf *h = &log.home[i];
+    log.ibuf[i] = bread(log.dev, SLOT((log.dh.start + i) % log.nslot));
+
+    // Only the newest copy of a block needs to go home; two
+    // writes of one block in a batch could land in any order.
+    for (j = i + 1; j < n; j++)
+      if (log.dh.block[j] == log.dh.block[i])
+        break;
+    if (j < n)
+      continue;
+
+    acquiresleep(&h->lock);
+    h->dev = log.dev;
+    h->blockno = log.dh.block[i];
+    h->data = log.ibuf[i]->data;
+    bwrite_async(h);
+  }
+  bkick();
+  for (i = 0; i < n; i++) {
+    struct buf *h = &log.home[i];
+    if (holdingsleep(&h->lock)) {
+      bwait(h);
+      h->data = 0;
+      releasesleep(&h->lock);
+    }
+    brelse(log.ibuf[i]);
+
+    // Installed; the cache may evict the block now. It is
+    // pinned, so this bread() does not go to the disk.
+    struct buf *dbuf = bread(log.dev, log.dh.block[i]);
+    bunpin(dbuf);
     brelse(dbuf);
   }
 }
@@ -89,58 +187,131 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.dh.start = lh->start;
+  log.dh.n = lh->n;
+  for (i = 0; i < log.dh.n; i++) {
+    log.dh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the in-memory header of committed blocks to disk,
+// followed by the blocks of clh if commit is set.
+// This is the true point at which a transaction commits,
+// and at which installed blocks leave the log. Holding the
+// header buffer's lock while copying orders concurrent
+// writers, so the last write carries the newest header.
+//
+// Crash ordering: dh lists only blocks whose header is on
+// disk, since the checkpointer installs whatever dh lists,
+// and installing part of a transaction that recovery does
+// not know about cannot be undone. So clh joins dh only after
+// the header listing it is written; and it joins before the
+// header buffer is released, so that a checkpointer's header
+// written afterwards still lists it.
 static void
-write_head(void)
+write_head(int commit)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  acquire(&log.lock);
+  hb->start = log.dh.start;
+  hb->n = log.dh.n;
+  for (i = 0; i < log.dh.n; i++) {
+    hb->block[i] = log.dh.block[i];
   }
+  if (commit) {
+    for (i = 0; i < log.clh.n; i++)
+      hb->block[hb->n + i] = log.clh.block[i];
+    hb->n += log.clh.n;
+  }
+  release(&log.lock);
   bwrite(buf);
+  if (commit) {
+    acquire(&log.lock);
+    for (i = 0; i < log.clh.n; i++)
+      log.dh.block[log.dh.n + i] = log.clh.block[i];
+    log.dh.n += log.clh.n;
+    release(&log.lock);
+  }
   brelse(buf);
 }
 
 static void
 recover_from_log(void)
 {
+  int i;
+
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  // if committed, copy from log to disk, oldest first
+  for (i = 0; i < log.dh.n; i++) {
+    struct buf *lbuf = bread(log.dev, SLOT((log.dh.start + i) % log.nslot));
+    struct buf *dbuf = bread(log.dev, log.dh.block[i]);
+    memmove(dbuf->data, lbuf->data, BSIZE);
+    bwrite(dbuf);
+    brelse(lbuf);
+    brelse(dbuf);
+  }
+  log.dh.start = 0;
+  log.dh.n = 0;
+  write_head(0); // clear the log
 }
 
-// called at the start of each FS system call.
+// Ask the checkpointer to free log space. Caller holds log.lock.
+static void
+wantspace(void)
+{
+  log.ckwanted = 1;
+  wakeup(&log.dh);
+}
+
+// called at the start of each FS system call that
+// writes at most n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  struct proc *p = myproc();
+
+  if(n > log.nslot)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.inuse + log.lh.n + log.reserved + n > log.nslot ||
+              log.ndata + log.reserved + n > LOGSIZE){
+      // this op might exhaust log space; wait for commit
+      // or checkpoint.
+      if(log.inuse > 0)
+        wantspace();
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      p->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// The largest reservation a single FS system call should
+// make: half the log, so that two can run at once.
+int
+log_opmax(void)
+{
+  return log.nslot / 2;
+}
+
 // called at the end of each FS system call.
 // commits if this was the last outstanding operation.
 void
@@ -150,6 +321,8 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logres;
+  myproc()->logres = 0;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
@@ -167,38 +340,138 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Is block b listed in header h? Caller holds log.lock.
+static int
+inheader(struct logheader *h, int b)
+{
+  int i;
+
+  for (i = 0; i < h->n; i++)
+    if (h->block[i] == b)
+      return 1;
+  return 0;
+}
+
+// Copy modified blocks from cache to the log, starting at
+// slot pos, and write the nd file data blocks in cdata[] in
+// place, then unpin those.
 static void
-write_log(void)
+write_log(int pos, int nd)
 {
-  int tail;
+  int tail, i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  for (i = 0; i < nd; i++) {
+    // A data block the transaction also logged goes
+    // home through the log.
+    log.dbuf[i] = 0;
+    if (inheader(&log.clh, log.cdata[i]))
+      continue;
+    log.dbuf[i] = bread(log.dev, log.cdata[i]);
+    bwrite_async(log.dbuf[i]);
+  }
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *to = bread(log.dev, SLOT((pos + tail) % log.nslot)); // log block
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    bwrite_async(to);  // write the log
     brelse(from);
-    brelse(to);
+    log.wbuf[tail] = to;
+  }
+  bkick();
+  for (i = 0; i < nd; i++) {
+    struct buf *b = log.dbuf[i];
+    if (b == 0)
+      b = bread(log.dev, log.cdata[i]);  // pinned; no disk read
+    else
+      bwait(b);
+    bunpin(b);
+    brelse(b);
+  }
+  for (tail = 0; tail < log.clh.n; tail++) {
+    bwait(log.wbuf[tail]);
+    brelse(log.wbuf[tail]);
   }
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int pos, i, nd;
+
+  acquire(&log.lock);
+  log.clh = log.lh;
+  log.lh.n = 0;
+  nd = log.ndata;
+  for (i = 0; i < nd; i++)
+    log.cdata[i] = log.data[i];
+  log.ndata = 0;
+  log.nfreed = 0;
+  log.ndatablocks += nd;
+  while(log.inuse + log.clh.n > log.nslot)
+  {
+    wantspace();
+    sleep(&log, &log.lock);
+  }
+  pos = (log.dh.start + log.dh.n) % log.nslot;
+  log.inuse += log.clh.n;
+  if(log.clh.n > 0){
+    log.ncommit++;
+    log.nblocks += log.clh.n;
+  }
+  if(log.inuse > log.maxinuse)
+    log.maxinuse = log.inuse;
+  release(&log.lock);
+
+  if (log.clh.n > 0 || nd > 0)
+    write_log(pos, nd);  // Write modified blocks from cache to log
+  if (log.clh.n > 0)
+    write_head(1);   // Write header to disk -- the real commit
+
+  acquire(&log.lock);
+  log.committing = 0;
+  if(log.inuse > log.nslot/2)
+    wakeup(&log.dh);
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// The checkpointer thread: installs committed transactions
+// and frees their log space, lazily.
+static void
+checkpointer(void)
+{
+  int n, i;
+
+  acquire(&log.lock);
+  for(;;){
+    while(log.dh.n == 0 || (!log.ckwanted && log.inuse <= log.nslot/2))
+      sleep(&log.dh, &log.lock);
+    log.ckwanted = 0;
+    n = log.dh.n;
+    release(&log.lock);
+
+    // Commits only append to dh, so its first n entries
+    // hold still without the lock; and they append only
+    // once their header is on disk, so all n are committed.
+    install_trans(n);
+
+    acquire(&log.lock);
+    log.dh.start = (log.dh.start + n) % log.nslot;
+    log.dh.n -= n;
+    for (i = 0; i < log.dh.n; i++)
+      log.dh.block[i] = log.dh.block[i + n];
+    release(&log.lock);
+
+    // The slots can't be reused until the header that no
+    // longer lists them is on disk.
+    write_head(0);
+
+    acquire(&log.lock);
+    log.inuse -= n;
+    wakeup(&log);
   }
 }
 
@@ -217,7 +490,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.nslot)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -230,7 +503,97 @@ log_write(struct buf *b)
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
     log.lh.n++;
+    if (myproc()->logres > 0) { // it was reserved
+      myproc()->logres--;
+      log.reserved--;
+    }
+  }
+  release(&log.lock);
+}
+
+// Did the current transaction free block b? Errs toward yes
+// if it freed too many to list. Caller holds log.lock.
+static int
+log_freed(int b)
+{
+  int i;
+
+  if (log.nfreed > NFREED)
+    return 1;
+  for (i = 0; i < log.nfreed; i++)
+    if (log.freed[i] == b)
+      return 1;
+  return 0;
+}
+
+// Like log_write(), for a block of regular file data: pin it,
+// and have commit() write it in place before the header.
+// The checks are made on every call, since a block listed
+// earlier in the transaction may since have been logged or
+// freed; such a block leaves data[] and goes through the log.
+void
+log_data(struct buf *b)
+{
+  int i;
+
+#ifdef DATAJOURNAL
+  log_write(b);
+  return;
+#endif
+
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i] == b->blockno)   // already listed
+      break;
   }
+  if ((i == log.ndata && log.ndata >= LOGSIZE) ||
+     inheader(&log.lh, b->blockno) || inheader(&log.dh, b->blockno) ||
+     log_freed(b->blockno)) {
+    if (i < log.ndata) {
+      // Its slot in data[] moves to the log, so hand the
+      // reservation it used back for log_write() to take.
+      log.data[i] = log.data[--log.ndata];
+      myproc()->logres++;
+      log.reserved++;
+      bunpin(b);
+    }
+    release(&log.lock);
+    log_write(b);
+    return;
+  }
+  if (i == log.ndata) {
+    bpin(b);
+    log.data[log.ndata++] = b->blockno;
+    if (myproc()->logres > 0) { // it was reserved
+      myproc()->logres--;
+      log.reserved--;
+    }
+  }
+  release(&log.lock);
+}
+
+// Note that the current transaction freed block b.
+void
+log_free(int b)
+{
+  acquire(&log.lock);
+  if (log.nfreed < NFREED)
+    log.freed[log.nfreed] = b;
+  if (log.nfreed <= NFREED)
+    log.nfreed++;
   release(&log.lock);
 }
 
+// Print log utilization, for procdump.
+void
+logstat(void)
+{
+  printf("log: %d slots, %d in use, %d at most, %d commits of %d blocks on average\n",
+         log.nslot, log.inuse, log.maxinuse, (int)log.ncommit,
+         log.ncommit ? (int)(log.nblocks / log.ncommit) : 0);
+  printf("log: %d data blocks written in place\n", (int)log.ndatablocks);
+}
+
@@ -2,12 +2,17 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum number of in-memory i-nodes
+#define NINODEMAX    1024  // maximum number of in-memory i-nodes
+#define ICACHEFRAC   256   // i-node table gets 1/ICACHEFRAC of free memory at boot
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      252 // max data blocks in on-disk log; mkfs -l sets the actual size
+#define NBUF         (LOGSIZE*4)  // minimum size of disk block cache
+#define NBUFMAX      8192  // maximum size of disk block cache
+#define BCACHEFRAC   16    // cache gets 1/BCACHEFRAC of free memory at boot
+#define FSSIZE       20000 // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define TICKINTERVAL 1000000 // timer cycles per tick; about 1/10th second in qemu
@@ -8,11 +8,19 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The ring is a page of its own. Readers and writers copy
+// whole contiguous spans of it, and wake each other only when
+// it matters: readers sleep only on an empty pipe, so writers
+// wake them only when it stops being empty; writers sleep only
+// on a full one, so readers wake them only when they take
+// from a full pipe.
+#define PIPESIZE PGSIZE
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // PIPESIZE bytes
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
@@ -30,6 +38,8 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if((pi->data = kalloc()) == 0)
+    goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -46,8 +56,11 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
+  if(pi){
+    if(pi->data)
+      kfree(pi->data);
     kfree((char*)pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,46 +81,58 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    kfree(pi->data);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes from addr, a user virtual address if
+// user_src is 1, else a kernel address. Returns the number
+// written, which is short if the reader goes away or the
+// caller is killed partway, or -1 if none were.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m;
+  uint off;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
   while(i < n){
     if(pi->readopen == 0 || killed(pr)){
       release(&pi->lock);
-      return -1;
+      return i > 0 ? i : -1;  // report what already went in
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      continue;
     }
+    // Copy as much as fits before the end of the ring.
+    off = pi->nwrite % PIPESIZE;
+    m = min(n - i, PIPESIZE - (pi->nwrite - pi->nread));
+    m = min(m, PIPESIZE - off);
+    if(either_copyin(pi->data + off, user_src, addr + i, m) == -1)
+      break;
+    if(pi->nwrite == pi->nread)
+      wakeup(&pi->nread);
+    pi->nwrite += m;
+    i += m;
   }
-  wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
 }
 
+// Read up to n bytes to addr, a user virtual address if
+// user_dst is 1, else a kernel address.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n)
 {
-  int i;
+  int i, m;
+  uint off;
+  int full;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -117,14 +142,17 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  full = (pi->nwrite == pi->nread + PIPESIZE);
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    off = pi->nread % PIPESIZE;
+    m = min(n - i, pi->nwrite - pi->nread);
+    m = min(m, PIPESIZE - off);
+    if(either_copyout(user_dst, addr + i, pi->data + off, m) == -1)
       break;
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(i > 0 && full)
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
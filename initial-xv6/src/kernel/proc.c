@@ -3,7 +3,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
+#include "rusage.h"
+#include "schedstat.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -17,6 +20,7 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void kickidle(void);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,6 +30,35 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// Sleeping processes, hashed by wait channel, so that
+// wakeup() only visits processes that might be sleeping
+// on its channel instead of the whole proc[] table.
+// A bucket's lock must be acquired before any p->lock.
+// wakeup() only reads the list, so it takes the lock for
+// reading and wakeups on one bucket can run in parallel.
+#define NWAITQ 64
+#define WAITQ(chan) (&waitq[((uint64)(chan) >> 3) % NWAITQ])
+struct waitq
+{
+  struct rwlock lock;
+  struct proc *head; // linked through p->qnext
+} waitq[NWAITQ];
+
+// wakeup() calls, and processes it examined, for procdump.
+uint64 nwakeup, nwakescan;
+
+// Scheduler histograms, one per CPU. Each is written only by
+// its own CPU with interrupts off, so no lock is needed.
+struct schedstat schedstats[NCPU];
+
+// Admission control for the EDF (earliest deadline first)
+// real-time class: the sum of budget/period over all EDF
+// processes, in thousandths of a CPU, may not exceed EDFMAXUTIL.
+#define EDFMAXUTIL 900
+struct spinlock edf_lock;
+int edf_util; // admitted utilization, per mille
+int nedf;     // number of EDF processes; read without the lock as a hint
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -50,6 +83,9 @@ void procinit(void)
 
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&edf_lock, "edf");
+  for (int i = 0; i < NWAITQ; i++)
+    initrwlock(&waitq[i].lock, "waitq");
   for (p = proc; p < &proc[NPROC]; p++)
   {
     initlock(&p->lock, "proc");
@@ -100,6 +136,160 @@ int allocpid()
   return pid;
 }
 
+// Move p to a new state, charging the time since its last
+// state change to the state it is leaving. This keeps run,
+// wait and sleep time exact at O(1) cost per transition.
+// Caller must hold p->lock.
+static void
+setstate(struct proc *p, enum procstate state)
+{
+  uint64 now = r_time();
+  uint64 delta = now - p->stamp;
+
+  switch (p->state)
+  {
+  case RUNNING:
+    p->rtime += delta;
+    if (p->edf_period)
+      p->edf_used += delta;
+    break;
+  case RUNNABLE:
+    p->wtime += delta;
+    break;
+  case SLEEPING:
+    p->stime += delta;
+    break;
+  default:
+    break;
+  }
+  p->state = state;
+  p->stamp = now;
+}
+
+// Start a new EDF period for p if its deadline has passed:
+// the budget is replenished and the deadline moves on.
+// Caller must hold p->lock.
+static void
+edfrefresh(struct proc *p, uint64 now)
+{
+  if (now < p->edf_deadline)
+    return;
+  p->edf_deadline += ((now - p->edf_deadline) / p->edf_period + 1) * p->edf_period;
+  p->edf_used = 0;
+}
+
+// May p run in the EDF class right now? A process that has
+// used up its budget for this period runs round-robin
+// until the next period starts.
+// Caller must hold p->lock.
+static int
+edfready(struct proc *p, uint64 now)
+{
+  if (p->edf_period == 0 || p->state != RUNNABLE)
+    return 0;
+  edfrefresh(p, now);
+  return p->edf_used < p->edf_budget;
+}
+
+// Find the runnable EDF process with the earliest deadline
+// that still has budget left. Returns it with p->lock held,
+// or 0 if there is none.
+static struct proc *
+edfpick(void)
+{
+  struct proc *p, *best;
+  uint64 now;
+
+  if (nedf == 0)
+    return 0;
+
+  // Pick a candidate without locks, then make sure of it.
+  now = r_time();
+  best = 0;
+  for (p = proc; p < &proc[NPROC]; p++)
+    if (p->edf_period && p->state == RUNNABLE &&
+        (p->edf_used < p->edf_budget || now >= p->edf_deadline) &&
+        (best == 0 || p->edf_deadline < best->edf_deadline))
+      best = p;
+  if (best == 0)
+    return 0;
+
+  acquire(&best->lock);
+  if (edfready(best, now))
+    return best;
+  release(&best->lock);
+  return 0;
+}
+
+// Is there a runnable EDF process that should preempt the
+// current one? Called from the clock interrupt.
+int edfpreempt(void)
+{
+  struct proc *me = myproc(), *p;
+  uint64 now;
+
+  if (nedf == 0)
+    return 0;
+  now = r_time();
+  for (p = proc; p < &proc[NPROC]; p++)
+  {
+    if (p == me || p->edf_period == 0 || p->state != RUNNABLE)
+      continue;
+    if (p->edf_used >= p->edf_budget && now < p->edf_deadline)
+      continue; // out of budget until its next period
+    if (me == 0 || me->edf_period == 0 || me->edf_used >= me->edf_budget ||
+        p->edf_deadline < me->edf_deadline)
+      return 1;
+  }
+  return 0;
+}
+
+// The share of a CPU that budget out of every period takes,
+// per mille, rounded up so that any budget counts as an EDF
+// process. Computed in 64 bits, since budget*1000 can
+// overflow an int.
+static int
+edfutil(uint64 period, uint64 budget)
+{
+  if (period == 0 || budget == 0)
+    return 0;
+  return (budget * 1000 + period - 1) / period;
+}
+
+// Put the calling process in the EDF class: it asks for budget
+// ticks of CPU in every period ticks, and is dispatched ahead
+// of round-robin processes, earliest deadline first.
+// setdeadline(0, 0) returns it to round-robin.
+// Returns -1 if admitting it would overcommit the CPU.
+int setdeadline(int period, int budget)
+{
+  struct proc *p = myproc();
+  int util, old;
+
+  if (period < 0 || budget < 0 || budget > period || (period == 0) != (budget == 0))
+    return -1;
+  util = edfutil(period, budget);
+
+  acquire(&edf_lock);
+  old = edfutil(p->edf_period, p->edf_budget);
+  if (edf_util - old + util > EDFMAXUTIL)
+  {
+    release(&edf_lock);
+    return -1;
+  }
+  edf_util += util - old;
+  nedf += (util != 0) - (old != 0);
+  release(&edf_lock);
+
+  acquire(&p->lock);
+  p->edf_period = (uint64)period * TICKINTERVAL;
+  p->edf_budget = (uint64)budget * TICKINTERVAL;
+  p->edf_deadline = r_time() + p->edf_period;
+  p->edf_used = 0;
+  release(&p->lock);
+  return 0;
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
@@ -150,8 +340,21 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
   p->rtime = 0;
+  p->wtime = 0;
+  p->stime = 0;
+  p->utime = 0;
+  p->nvcsw = 0;
+  p->nivcsw = 0;
+  p->ncow = 0;
+  p->nbread = 0;
+  p->edf_period = 0;
+  p->edf_budget = 0;
+  p->edf_used = 0;
+  p->gang = 0;
+  p->kfn = 0;
+  p->logres = 0;
   p->etime = 0;
-  p->ctime = ticks;
+  p->ctime = p->stamp = r_time();
   return p;
 }
 
@@ -254,11 +457,42 @@ void userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setstate(p, RUNNABLE);
 
   release(&p->lock);
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+  myproc()->kfn();
+  panic("kthread return");
+}
+
+// Start a kernel thread: a process that runs fn in the
+// kernel and never goes to user space. fn must not return.
+// Must be called from process context (the file system
+// starts its threads from forkret()).
+int
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    return -1;
+  p->context.ra = (uint64)kthreadret;
+  p->kfn = fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setstate(p, RUNNABLE);
+  kickidle();
+  release(&p->lock);
+  return p->pid;
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
@@ -318,6 +552,7 @@ int fork(void)
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
+  np->gang = p->gang;
 
   pid = np->pid;
 
@@ -328,7 +563,8 @@ int fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setstate(np, RUNNABLE);
+  kickidle();
   release(&np->lock);
 
   return pid;
@@ -376,6 +612,10 @@ void exit(int status)
   end_op();
   p->cwd = 0;
 
+  // Give back any real-time CPU reservation.
+  if (p->edf_period)
+    setdeadline(0, 0);
+
   acquire(&wait_lock);
 
   // Give any children to init.
@@ -387,8 +627,8 @@ void exit(int status)
   acquire(&p->lock);
 
   p->xstate = status;
-  p->state = ZOMBIE;
-  p->etime = ticks;
+  setstate(p, ZOMBIE);
+  p->etime = p->stamp;
 
   release(&wait_lock);
 
@@ -451,17 +691,147 @@ int wait(uint64 addr)
   }
 }
 
+// Wake an idle hart, if there is one, so that a process just
+// made RUNNABLE is dispatched at once rather than when this
+// hart next gives up its CPU. The kick arrives through
+// timervec as a software interrupt.
+// Interrupts must be disabled.
+static void
+kickidle(void)
+{
+  struct cpu *c;
+
+  for (c = cpus; c < &cpus[NCPU]; c++)
+  {
+    if (c->idle && c != mycpu())
+    {
+      c->idle = 0;
+      *(volatile uint32 *)CLINT_MSIP(c - cpus) = 1;
+      return;
+    }
+  }
+}
+
+// If another hart is running a member of a gang, find a
+// RUNNABLE member of the same gang to run alongside it, so
+// that the stages of a pipeline run at the same time on
+// different harts instead of taking turns on one.
+// Returns it with p->lock held, or 0 if there is none.
+static struct proc *
+gangpick(void)
+{
+  struct cpu *c;
+  struct proc *p;
+  int gang;
+
+  for (c = cpus; c < &cpus[NCPU]; c++)
+  {
+    if (c == mycpu() || (gang = c->gang) == 0)
+      continue;
+    for (p = proc; p < &proc[NPROC]; p++)
+    {
+      if (p->gang != gang || p->state != RUNNABLE) // racy peek
+        continue;
+      acquire(&p->lock);
+      if (p->gang == gang && p->state == RUNNABLE)
+        return p;
+      release(&p->lock);
+    }
+  }
+  return 0;
+}
+
+// Make the caller, and the children it forks from now on,
+// a gang whose members the scheduler tries to run at the
+// same time on different harts. sh uses this for pipelines.
+// Returns the gang id; a process already in a gang stays in it.
+int setgang(void)
+{
+  struct proc *p = myproc();
+  int gang;
+
+  acquire(&p->lock);
+  if (p->gang == 0)
+    p->gang = p->pid;
+  gang = p->gang;
+  release(&p->lock);
+  return gang;
+}
+
+// Count a duration of d cycles in log2 histogram h.
+static void
+histadd(uint64 *h, uint64 d)
+{
+  int i = 0;
+
+  while (d > 1 && i < NSCHEDHIST - 1)
+  {
+    d >>= 1;
+    i++;
+  }
+  h[i]++;
+}
+
+// Copy CPU cpu's scheduler histograms to user address addr.
+int schedstat(int cpu, uint64 addr)
+{
+  struct proc *p = myproc();
+
+  if (cpu < 0 || cpu >= NCPU)
+    return -1;
+  return copyout(p->pagetable, addr, (char *)&schedstats[cpu],
+                 sizeof(struct schedstat));
+}
+
+// Run p on this CPU until it gives the CPU back.
+// Caller must hold p->lock.
+static void
+dispatch(struct cpu *c, struct proc *p)
+{
+  // Switch to chosen process.  It is the process's job
+  // to release its lock and then reacquire it
+  // before jumping back to us.
+  struct schedstat *st = &schedstats[c - cpus];
+  uint64 start;
+
+  histadd(st->latency, r_time() - p->stamp);
+  setstate(p, RUNNING);
+  start = p->stamp;
+  c->proc = p;
+  c->gang = p->gang;
+
+  // Start a fresh time slice, cut short if an EDF
+  // process has less budget than that left.
+  c->slice_end = p->stamp + TICKINTERVAL;
+  if (p->edf_period && p->edf_used < p->edf_budget &&
+      p->edf_budget - p->edf_used < TICKINTERVAL)
+    c->slice_end = p->stamp + p->edf_budget - p->edf_used;
+  timerset();
+  swtch(&c->context, &p->context);
+
+  // Process is done running for now.
+  // It should have changed its p->state before coming back.
+  histadd(st->slice, p->stamp - start);
+  histadd(st->swtch, r_time() - p->stamp);
+  c->proc = 0;
+  c->gang = 0;
+  c->slice_end = 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run: the EDF process with the
+//    earliest deadline if one is ready, else a member of a
+//    gang running on another hart, else round-robin.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
 void scheduler(void)
 {
-  struct proc *p;
+  struct proc *p, *e;
   struct cpu *c = mycpu();
+  int found, due;
 
   c->proc = 0;
   for (;;)
@@ -469,24 +839,69 @@ void scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
+    found = 0;
+    due = 1;
     for (p = proc; p < &proc[NPROC]; p++)
     {
+      // Real-time processes go ahead of the round-robin scan,
+      // then a partner for a gang running elsewhere. Look for
+      // them at the start of the pass and again after each
+      // process has run, not at every step of the scan.
+      if (due)
+      {
+        while ((e = edfpick()) != 0)
+        {
+          dispatch(c, e);
+          release(&e->lock);
+          found = 1;
+        }
+        due = 0;
+
+        // Only one gang member per step, so that gangs
+        // cannot starve everyone else.
+        if ((e = gangpick()) != 0)
+        {
+          dispatch(c, e);
+          release(&e->lock);
+          found = 1;
+          due = 1;
+        }
+      }
+
       acquire(&p->lock);
       if (p->state == RUNNABLE)
       {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+        dispatch(c, p);
+        found = 1;
+        due = 1;
       }
       release(&p->lock);
     }
+
+    if (!found)
+    {
+      // Nothing to run. Check again with interrupts off, so
+      // that a wakeup from an interrupt taken after the scan
+      // above leaves that interrupt pending and wfi() returns
+      // at once. Otherwise stop the slice timer and idle until
+      // a device or a sleep() deadline needs us.
+      // Advertise that we are idle first, so that a wakeup()
+      // after the check either is seen by it or kicks us.
+      intr_off();
+      c->idle = 1;
+      __sync_synchronize();
+      for (p = proc; p < &proc[NPROC]; p++)
+        if (p->state == RUNNABLE) // racy peek; the scan above locks.
+          break;
+      if (p == &proc[NPROC])
+      {
+        uint64 t0 = r_time();
+        timerset();
+        wfi();
+        histadd(schedstats[c - cpus].idle, r_time() - t0);
+      }
+      c->idle = 0;
+    }
   }
 }
 
@@ -521,7 +936,8 @@ void yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setstate(p, RUNNABLE);
+  p->nivcsw++;
   sched();
   release(&p->lock);
 }
@@ -552,6 +968,13 @@ void forkret(void)
 void sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *q = WAITQ(chan);
+  struct proc **pp;
+
+  // Join chan's wait queue, so that wakeup(chan) can find us.
+  acquirewrite(&q->lock);
+  p->qnext = q->head;
+  q->head = p;
 
   // Must acquire p->lock in order to
   // change p->state and then call sched.
@@ -561,19 +984,35 @@ void sleep(void *chan, struct spinlock *lk)
   // so it's okay to release lk.
 
   acquire(&p->lock); // DOC: sleeplock1
+  releasewrite(&q->lock);
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
-  p->state = SLEEPING;
+  setstate(p, SLEEPING);
+  p->nvcsw++;
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // Leave the wait queue. wakeup() only changes our state,
+  // so this also covers being woken by kill().
+  acquirewrite(&q->lock);
+  for (pp = &q->head; *pp; pp = &(*pp)->qnext)
+  {
+    if (*pp == p)
+    {
+      *pp = p->qnext;
+      break;
+    }
+  }
+  p->qnext = 0;
+  releasewrite(&q->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -581,20 +1020,28 @@ void sleep(void *chan, struct spinlock *lk)
 // Must be called without any p->lock.
 void wakeup(void *chan)
 {
+  struct waitq *q = WAITQ(chan);
   struct proc *p;
+  int n = 0, woke = 0;
 
-  for (p = proc; p < &proc[NPROC]; p++)
+  acquireread(&q->lock);
+  for (p = q->head; p; p = p->qnext)
   {
-    if (p != myproc())
+    n++;
+    acquire(&p->lock);
+    if (p->state == SLEEPING && p->chan == chan)
     {
-      acquire(&p->lock);
-      if (p->state == SLEEPING && p->chan == chan)
-      {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+      setstate(p, RUNNABLE);
+      woke = 1;
     }
+    release(&p->lock);
   }
+  if (woke)
+    kickidle();
+  releaseread(&q->lock);
+
+  __sync_fetch_and_add(&nwakeup, 1);
+  __sync_fetch_and_add(&nwakescan, n);
 }
 
 // Kill the process with the given pid.
@@ -613,7 +1060,7 @@ int kill(int pid)
       if (p->state == SLEEPING)
       {
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setstate(p, RUNNABLE);
       }
       release(&p->lock);
       return 0;
@@ -690,6 +1137,15 @@ void procdump(void)
   char *state;
 
   printf("\n");
+  printf("wakeup: %d calls, %d procs scanned\n", (int)nwakeup, (int)nwakescan);
+  printf("sleeplock: %d spun, %d slept\n", (int)nsleepspin, (int)nsleepwait);
+  bstat();
+  istat();
+  dcstat();
+  logstat();
+#ifdef LOCKSTAT
+  lockdump();
+#endif
   for (p = proc; p < &proc[NPROC]; p++)
   {
     if (p->state == UNUSED)
@@ -699,12 +1155,15 @@ void procdump(void)
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    printf(" r=%d w=%d s=%d", (int)(p->rtime / TICKINTERVAL),
+           (int)(p->wtime / TICKINTERVAL), (int)(p->stime / TICKINTERVAL));
     printf("\n");
   }
 }
 
-// waitx
-int waitx(uint64 addr, uint *wtime, uint *rtime)
+// Wait for a child process to exit, like wait(), and
+// fill in *ru with the resources it used.
+int waitx(uint64 addr, struct rusage *ru)
 {
   struct proc *np;
   int havekids, pid;
@@ -728,8 +1187,14 @@ int waitx(uint64 addr, uint *wtime, uint *rtime)
         {
           // Found one.
           pid = np->pid;
-          *rtime = np->rtime;
-          *wtime = np->etime - np->ctime - np->rtime;
+          ru->utime = np->utime;
+          ru->ktime = np->rtime > np->utime ? np->rtime - np->utime : 0;
+          ru->wtime = np->wtime;
+          ru->stime = np->stime;
+          ru->nvcsw = np->nvcsw;
+          ru->nivcsw = np->nivcsw;
+          ru->ncow = np->ncow;
+          ru->nbread = np->nbread;
           if (addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
                                    sizeof(np->xstate)) < 0)
           {
@@ -757,17 +1222,3 @@ int waitx(uint64 addr, uint *wtime, uint *rtime)
     sleep(p, &wait_lock); // DOC: wait-sleep
   }
 }
-
-void update_time()
-{
-  struct proc *p;
-  for (p = proc; p < &proc[NPROC]; p++)
-  {
-    acquire(&p->lock);
-    if (p->state == RUNNING)
-    {
-      p->rtime++;
-    }
-    release(&p->lock);
-  }
-}
\ No newline at end of file
@@ -26,6 +26,9 @@ struct cpu
   struct context context; // swtch() here to enter scheduler().
   int noff;               // Depth of push_off() nesting.
   int intena;             // Were interrupts enabled before push_off()?
+  uint64 slice_end;       // mtime at which c->proc's time slice ends, or 0.
+  int idle;               // Waiting in wfi() for something to run?
+  int gang;               // Gang of c->proc, or 0.
 };
 
 extern struct cpu cpus[NCPU];
@@ -103,10 +106,18 @@ struct proc
   int killed;           // If non-zero, have been killed
   int xstate;           // Exit status to be returned to parent's wait
   int pid;              // Process ID
+  int gang;             // If non-zero, co-schedule with this gang (see setgang())
 
   // wait_lock must be held when using this:
   struct proc *parent; // Parent process
 
+  // the lock of chan's wait queue must be held when using this:
+  struct proc *qnext;  // Next sleeper in the same wait queue
+
+  // tickslock must be held when using these:
+  uint wake;           // If non-zero, tick to wake at from sys_sleep()
+  struct proc *wnext;  // Next sleeper in the same timer-wheel bucket
+
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
@@ -116,9 +127,26 @@ struct proc
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-  uint rtime;                  // How long the process ran for
-  uint ctime;                  // When was the process created
-  uint etime;                  // When did the process exited
+  void (*kfn)(void);           // If non-zero, a kernel thread running kfn
+  int logres;                  // Log slots reserved by begin_op() and not yet used
+  uint64 rtime;                // How long the process ran for (cycles)
+  uint64 wtime;                // How long it was RUNNABLE, waiting for a CPU (cycles)
+  uint64 stime;                // How long it was SLEEPING (cycles)
+  uint64 stamp;                // mtime of the last state change
+  uint64 utime;                // How much of rtime was in user mode (cycles)
+  uint64 ustamp;               // mtime of the last return to user mode
+  uint nvcsw;                  // Voluntary context switches
+  uint nivcsw;                 // Involuntary context switches
+  uint ncow;                   // Copy-on-write page faults
+  uint nbread;                 // Disk blocks read
+
+  // EDF real-time class (see setdeadline()); p->lock must be held.
+  uint64 edf_period;           // Period (cycles), or 0 if round-robin
+  uint64 edf_budget;           // CPU time allowed per period (cycles)
+  uint64 edf_deadline;         // End of the current period (mtime)
+  uint64 edf_used;             // CPU time used in the current period
+  uint64 ctime;                // When was the process created (mtime)
+  uint64 etime;                // When did the process exited (mtime)
 };
 
 extern struct proc proc[NPROC];
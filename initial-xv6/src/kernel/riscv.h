@@ -287,6 +287,15 @@ intr_get()
   return (x & SSTATUS_SIE) != 0;
 }
 
+// stall the hart until an interrupt is pending.
+// returns at once if one already is, even with
+// interrupts disabled.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 static inline uint64
 r_sp()
 {
@@ -0,0 +1,12 @@
+// Resource usage of a reaped child, filled in by waitx2().
+// Times are in mtime cycles (TICKINTERVAL cycles per tick).
+struct rusage {
+  uint64 utime;  // Running in user mode
+  uint64 ktime;  // Running in the kernel
+  uint64 wtime;  // RUNNABLE, waiting for a CPU
+  uint64 stime;  // SLEEPING
+  uint nvcsw;    // Voluntary context switches (sleep)
+  uint nivcsw;   // Involuntary context switches (preempted)
+  uint ncow;     // Copy-on-write page faults
+  uint nbread;   // Disk blocks read
+};
@@ -0,0 +1,93 @@
+// Reader-writer spin locks
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "proc.h"
+#include "defs.h"
+
+void
+initrwlock(struct rwlock *lk, char *name)
+{
+  lk->name = name;
+  lk->readers = 0;
+  lk->wwait = 0;
+  lk->cpu = 0;
+}
+
+// Acquire the lock for reading.
+// Spins while a writer holds or is waiting for the lock.
+void
+acquireread(struct rwlock *lk)
+{
+  int r;
+
+  push_off(); // disable interrupts to avoid deadlock.
+  if(holdingwrite(lk))
+    panic("acquireread");
+
+  for(;;){
+    while(*(volatile uint *)&lk->wwait != 0 ||
+          (r = *(volatile int *)&lk->readers) < 0)
+      ;
+    if(__sync_bool_compare_and_swap(&lk->readers, r, r + 1))
+      break;
+  }
+
+  // Keep the critical section's loads after the acquire.
+  __sync_synchronize();
+}
+
+void
+releaseread(struct rwlock *lk)
+{
+  if(lk->readers <= 0)
+    panic("releaseread");
+
+  __sync_synchronize();
+  __sync_fetch_and_sub(&lk->readers, 1);
+
+  pop_off();
+}
+
+// Acquire the lock for writing.
+// Spins until there are no readers and no other writer.
+void
+acquirewrite(struct rwlock *lk)
+{
+  push_off();
+  if(holdingwrite(lk))
+    panic("acquirewrite");
+
+  __sync_fetch_and_add(&lk->wwait, 1);
+  while(!__sync_bool_compare_and_swap(&lk->readers, 0, -1))
+    ;
+  __sync_fetch_and_sub(&lk->wwait, 1);
+
+  __sync_synchronize();
+  lk->cpu = mycpu();
+}
+
+void
+releasewrite(struct rwlock *lk)
+{
+  if(!holdingwrite(lk))
+    panic("releasewrite");
+
+  lk->cpu = 0;
+  __sync_synchronize();
+  __sync_fetch_and_add(&lk->readers, 1); // -1 -> 0
+
+  pop_off();
+}
+
+// Check whether this cpu is holding the lock for writing.
+// Interrupts must be off.
+int
+holdingwrite(struct rwlock *lk)
+{
+  return lk->readers < 0 && lk->cpu == mycpu();
+}
@@ -0,0 +1,15 @@
+// Reader-writer spin lock, for tables that are mostly
+// searched and seldom changed. Any number of readers may
+// hold it at once; a writer holds it alone. Waiting writers
+// hold off new readers, so a steady stream of lookups cannot
+// starve an update. Do not take a read lock twice on one cpu:
+// a writer arriving in between would deadlock both.
+struct rwlock {
+  int readers;       // Number of readers, or -1 if held by a writer.
+  uint wwait;        // Number of writers waiting.
+
+  // For debugging:
+  char *name;        // Name of lock.
+  struct cpu *cpu;   // The cpu holding the lock for writing.
+};
+
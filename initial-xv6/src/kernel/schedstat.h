@@ -0,0 +1,12 @@
+// Per-CPU scheduler statistics, returned by schedstat().
+// Each array is a log2 histogram of a duration in mtime
+// cycles: bucket i counts durations in [2^i, 2^(i+1)),
+// and bucket 0 also counts zero.
+#define NSCHEDHIST 32
+
+struct schedstat {
+  uint64 latency[NSCHEDHIST]; // RUNNABLE until dispatched
+  uint64 slice[NSCHEDHIST];   // RUNNING until the CPU is given back
+  uint64 swtch[NSCHEDHIST];   // giving the CPU back until scheduler() resumes
+  uint64 idle[NSCHEDHIST];    // time spent in wfi() with nothing to run
+};
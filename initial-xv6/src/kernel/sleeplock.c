@@ -9,6 +9,14 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+// How long acquiresleep() may spin waiting for a holder that
+// is running on another cpu before giving up and sleeping.
+#define SLEEPSPIN (TICKINTERVAL/100)
+
+// acquiresleep() calls that spun and got the lock,
+// and that had to sleep, for procdump.
+uint64 nsleepspin, nsleepwait;
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
@@ -16,18 +24,44 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
 }
 
+// While the holder is running on another cpu it is likely to
+// release the lock soon, and spinning for it is cheaper than
+// a trip through the scheduler; once it sleeps or is
+// preempted, or SLEEPSPIN runs out, sleep instead.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 start = r_time();
+  struct proc *owner;
+  int spun = 0, slept = 0;
+
   acquire(&lk->lk);
   while (lk->locked) {
+    owner = lk->owner;
+    if (owner && owner->state == RUNNING && r_time() - start < SLEEPSPIN) {
+      release(&lk->lk);
+      while (*(volatile uint *)&lk->locked && lk->owner == owner &&
+             owner->state == RUNNING && r_time() - start < SLEEPSPIN)
+        ;
+      spun = 1;
+      acquire(&lk->lk);
+      continue;
+    }
+    slept = 1;
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
   release(&lk->lk);
+
+  if (slept)
+    __sync_fetch_and_add(&nsleepwait, 1);
+  else if (spun)
+    __sync_fetch_and_add(&nsleepspin, 1);
 }
 
 void
@@ -36,10 +70,23 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
   wakeup(lk);
   release(&lk->lk);
 }
 
+// Hand a held lock over to no process in particular, such as
+// an I/O that will finish in an interrupt handler; whoever
+// releases it need not be the process that acquired it.
+void
+disownsleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->pid = 0;
+  lk->owner = 0;
+  release(&lk->lk);
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
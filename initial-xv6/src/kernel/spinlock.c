@@ -8,12 +8,69 @@
 #include "proc.h"
 #include "defs.h"
 
+#ifdef LOCKSTAT
+// Contention statistics, kept per lock name rather than per
+// lock, so that e.g. all "proc" locks are counted together
+// and locks in freed memory (pipes) leave nothing dangling.
+// Built only with make LOCKSTAT=1; dumped by procdump (^P).
+#define NLOCKSTAT 64
+struct lockstat {
+  char *name;
+  uint64 nacquire;   // acquisitions
+  uint64 ncontend;   // acquisitions that had to wait
+  uint64 nspin;      // loop iterations spent waiting
+  uint64 maxhold;    // longest hold, in cycles
+} lockstats[NLOCKSTAT];
+int nlockstat;
+uint lockstats_locked; // guards appending to lockstats[]
+
+static struct lockstat*
+lockstat_find(char *name)
+{
+  struct lockstat *ls = 0;
+  int i;
+
+  push_off();
+  while(__sync_lock_test_and_set(&lockstats_locked, 1) != 0)
+    ;
+  for(i = 0; i < nlockstat; i++){
+    if(lockstats[i].name == name || strncmp(lockstats[i].name, name, 32) == 0)
+      break;
+  }
+  if(i == nlockstat && nlockstat < NLOCKSTAT){
+    lockstats[i].name = name;
+    nlockstat++;
+  }
+  if(i < nlockstat)
+    ls = &lockstats[i];
+  __sync_lock_release(&lockstats_locked);
+  pop_off();
+  return ls;
+}
+
+// Print the lock statistics to the console.
+void
+lockdump(void)
+{
+  struct lockstat *ls;
+
+  printf("lock: acquire contend spin maxhold\n");
+  for(ls = lockstats; ls < &lockstats[nlockstat]; ls++)
+    printf("%s: %d %d %d %d\n", ls->name, (int)ls->nacquire,
+           (int)ls->ncontend, (int)ls->nspin, (int)ls->maxhold);
+}
+#endif
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+#ifdef LOCKSTAT
+  lk->stat = lockstat_find(name);
+#endif
 }
 
 // Acquire the lock.
@@ -21,16 +78,28 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket;
+#ifdef LOCKSTAT
+  uint64 spins = 0;
+#endif
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  // Take a ticket. On RISC-V, sync_fetch_and_add turns into
+  // an atomic add:
+  //   amoadd.w.aqrl a5, a4, (s1)
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+
+  // Wait for our turn, spinning on a plain load so that the
+  // cache line is shared among the waiters until the holder
+  // moves owner on.
+  while(*(volatile uint *)&lk->owner != ticket){
+#ifdef LOCKSTAT
+    spins++;
+#endif
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +109,17 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+#ifdef LOCKSTAT
+  if(lk->stat){
+    __sync_fetch_and_add(&lk->stat->nacquire, 1);
+    if(spins){
+      __sync_fetch_and_add(&lk->stat->ncontend, 1);
+      __sync_fetch_and_add(&lk->stat->nspin, spins);
+    }
+  }
+  lk->start = r_time();
+#endif
 }
 
 // Release the lock.
@@ -49,6 +129,12 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  uint64 held = r_time() - lk->start;
+  if(lk->stat && held > lk->stat->maxhold)
+    lk->stat->maxhold = held; // racy, but only a statistic.
+#endif
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,14 +145,11 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Serve the next ticket. Only the holder writes owner, but
+  // use an atomic add rather than a C increment, since the C
+  // standard implies that might be done with several stores.
+  //   amoadd.w zero, a5, (s1)
+  __sync_fetch_and_add(&lk->owner, 1);
 
   pop_off();
 }
@@ -77,7 +160,7 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->next != lk->owner && lk->cpu == mycpu());
   return r;
 }
 
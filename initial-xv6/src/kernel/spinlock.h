@@ -1,9 +1,19 @@
 // Mutual exclusion lock.
+//
+// A ticket lock: each acquirer takes the next ticket and
+// waits for its number to come up, so waiters are served
+// in FIFO order and, unlike a test-and-set loop, spin by
+// reading owner rather than hammering it with atomic swaps.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket now being served; held iff next != owner.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+#ifdef LOCKSTAT
+  struct lockstat *stat; // Contention counters for locks of this name.
+  uint64 start;          // mtime at which the lock was acquired.
+#endif
 };
 
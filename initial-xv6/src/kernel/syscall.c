@@ -102,6 +102,11 @@ extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_waitx(void);
+extern uint64 sys_waitx2(void);
+extern uint64 sys_setdeadline(void);
+extern uint64 sys_setgang(void);
+extern uint64 sys_schedstat(void);
+extern uint64 sys_splice(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -128,6 +133,11 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_waitx]   sys_waitx,
+[SYS_waitx2]  sys_waitx2,
+[SYS_setdeadline] sys_setdeadline,
+[SYS_setgang] sys_setgang,
+[SYS_schedstat] sys_schedstat,
+[SYS_splice]  sys_splice,
 };
 
 void
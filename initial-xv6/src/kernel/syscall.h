@@ -21,3 +21,8 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_waitx  22
+#define SYS_waitx2 23
+#define SYS_setdeadline 24
+#define SYS_setgang 25
+#define SYS_schedstat 26
+#define SYS_splice 27
@@ -76,7 +76,7 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  return fileread(f, 1, p, n);
 }
 
 uint64
@@ -91,7 +91,21 @@ sys_write(void)
   if(argfd(0, 0, &f) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  return filewrite(f, 1, p, n);
+}
+
+// Move up to n bytes from one open file to another
+// without copying them through user space.
+uint64
+sys_splice(void)
+{
+  struct file *fin, *fout;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0 || n < 0)
+    return -1;
+  return filesplice(fin, fout, n);
 }
 
 uint64
@@ -222,6 +236,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcenter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "rusage.h"
 
 uint64
 sys_exit(void)
@@ -53,18 +54,23 @@ sys_sleep(void)
 {
   int n;
   uint ticks0;
+  struct proc *p = myproc();
 
   argint(0, &n);
   acquire(&tickslock);
+  updateticks();
   ticks0 = ticks;
   while (ticks - ticks0 < n)
   {
-    if (killed(myproc()))
+    if (killed(p))
     {
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    wheeladd(p, ticks0 + n);
+    sleep(&p->wake, &tickslock);
+    wheeldel(p); // still queued if kill() woke us early.
+    updateticks();
   }
   release(&tickslock);
   return 0;
@@ -87,6 +93,7 @@ sys_uptime(void)
   uint xticks;
 
   acquire(&tickslock);
+  updateticks();
   xticks = ticks;
   release(&tickslock);
   return xticks;
@@ -97,14 +104,62 @@ sys_waitx(void)
 {
   uint64 addr, addr1, addr2;
   uint wtime, rtime;
+  struct rusage ru;
   argaddr(0, &addr);
   argaddr(1, &addr1); // user virtual memory
   argaddr(2, &addr2);
-  int ret = waitx(addr, &wtime, &rtime);
+  memset(&ru, 0, sizeof(ru));
+  int ret = waitx(addr, &ru);
+  rtime = (ru.utime + ru.ktime) / TICKINTERVAL;
+  wtime = (ru.wtime + ru.stime) / TICKINTERVAL;
   struct proc *p = myproc();
   if (copyout(p->pagetable, addr1, (char *)&wtime, sizeof(int)) < 0)
     return -1;
   if (copyout(p->pagetable, addr2, (char *)&rtime, sizeof(int)) < 0)
     return -1;
   return ret;
-}
\ No newline at end of file
+}
+
+// like waitx, but report the child's full resource usage
+// in a struct rusage.
+uint64
+sys_waitx2(void)
+{
+  uint64 addr, uru;
+  struct rusage ru;
+  argaddr(0, &addr);
+  argaddr(1, &uru); // user pointer to struct rusage
+  int ret = waitx(addr, &ru);
+  if (ret >= 0 && uru != 0 &&
+      copyout(myproc()->pagetable, uru, (char *)&ru, sizeof(ru)) < 0)
+    return -1;
+  return ret;
+}
+
+// put the caller in the EDF real-time class.
+uint64
+sys_setdeadline(void)
+{
+  int period, budget;
+  argint(0, &period);
+  argint(1, &budget);
+  return setdeadline(period, budget);
+}
+
+// co-schedule the caller and its future children.
+uint64
+sys_setgang(void)
+{
+  return setgang();
+}
+
+// copy one CPU's scheduler histograms to the caller.
+uint64
+sys_schedstat(void)
+{
+  int cpu;
+  uint64 st; // user pointer to struct schedstat
+  argint(0, &cpu);
+  argaddr(1, &st);
+  return schedstat(cpu, st);
+}
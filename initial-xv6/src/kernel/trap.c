@@ -47,6 +47,7 @@ int cow_pagefault(pagetable_t pagetable, uint64 va)
   }
   memmove((void *)newpa, (void *)oldpa, PGSIZE);
   kfree((void *)oldpa);
+  myproc()->ncow++;
 
   uint64 flags = PTE_FLAGS(*pte);
   flags &= ~PTE_COW; // remove cow flag
@@ -72,6 +73,9 @@ void usertrap(void)
 
   struct proc *p = myproc();
 
+  // charge the time since usertrapret() to user mode.
+  p->utime += r_time() - p->ustamp;
+
   // save user program counter.
   p->trapframe->epc = r_sepc();
 
@@ -160,6 +164,7 @@ void usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
+  p->ustamp = r_time();
   ((void (*)(uint64))trampoline_userret)(satp);
 }
 
@@ -194,33 +199,140 @@ void kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Processes in sys_sleep() wait on a hashed timer wheel,
+// bucketed by the tick at which they want to wake, so that
+// each clock interrupt wakes only the sleepers that are due
+// rather than every process sleeping on &ticks.
+// Protected by tickslock.
+#define NWHEEL 32
+#define NOWAKE ((uint)-1)
+static struct proc *wheel[NWHEEL];
+static uint wheelmin[NWHEEL]; // no p->wake in the bucket is earlier.
+static uint wheeltick; // buckets up to this tick have been expired.
+static uint nextwake = NOWAKE; // no p->wake in the wheel is earlier.
+
+// Bring ticks up to date with mtime. No hart takes clock
+// interrupts while the machine is idle, so ticks is
+// refreshed whenever someone is about to look at it.
+// Caller must hold tickslock.
+void
+updateticks(void)
+{
+  ticks = r_time() / TICKINTERVAL;
+}
+
+// Queue p to be woken, on channel &p->wake, at tick when.
+// Caller must hold tickslock.
+void
+wheeladd(struct proc *p, uint when)
+{
+  int i = when % NWHEEL;
+
+  if (wheel[i] == 0 || when < wheelmin[i])
+    wheelmin[i] = when;
+  p->wake = when;
+  p->wnext = wheel[i];
+  wheel[i] = p;
+  if (when < nextwake)
+    nextwake = when;
+}
+
+// Take p off the wheel, if it is still there.
+// Caller must hold tickslock.
+void
+wheeldel(struct proc *p)
+{
+  struct proc **pp;
+
+  if (p->wake == 0)
+    return;
+  for (pp = &wheel[p->wake % NWHEEL]; *pp; pp = &(*pp)->wnext)
+  {
+    if (*pp == p)
+    {
+      *pp = p->wnext;
+      break;
+    }
+  }
+  p->wake = 0;
+  p->wnext = 0;
+}
+
+// Wake every sleeper whose tick has come, visiting only the
+// buckets for ticks that have passed since the last call.
+// After a long idle stretch one full turn covers them all.
+// The minimum of each visited bucket is recomputed on the
+// way; nextwake then comes from the per-bucket minima, so
+// sleepers in other buckets are not walked again.
+// Caller must hold tickslock.
+static void
+wheelexpire(void)
+{
+  struct proc **pp, *p;
+  uint t, min;
+  int i;
+
+  for (t = wheeltick + 1, i = 0; t <= ticks && i < NWHEEL; t++, i++)
+  {
+    min = NOWAKE;
+    for (pp = &wheel[t % NWHEEL]; (p = *pp) != 0;)
+    {
+      if (p->wake <= ticks)
+      {
+        *pp = p->wnext;
+        p->wake = 0;
+        p->wnext = 0;
+        wakeup(&p->wake);
+      }
+      else
+      {
+        if (p->wake < min)
+          min = p->wake;
+        pp = &p->wnext;
+      }
+    }
+    wheelmin[t % NWHEEL] = min;
+  }
+  wheeltick = ticks;
+
+  nextwake = NOWAKE;
+  for (i = 0; i < NWHEEL; i++)
+    if (wheel[i] && wheelmin[i] < nextwake)
+      nextwake = wheelmin[i];
+}
+
+// Program this hart's one-shot timer for whichever comes
+// first: the end of the running process's time slice, or
+// the earliest sleep() deadline. Leave it disarmed if
+// neither is pending, so that an idle hart is not disturbed.
+// Interrupts must be disabled.
+void
+timerset(void)
+{
+  struct cpu *c = mycpu();
+  uint64 when = -1;
+  uint wake = nextwake; // racy peek; a stale value only costs a spurious interrupt.
+
+  if (c->slice_end)
+    when = c->slice_end;
+  if (wake != NOWAKE && (uint64)wake * TICKINTERVAL < when)
+    when = (uint64)wake * TICKINTERVAL;
+  *(uint64 *)CLINT_MTIMECMP(cpuid()) = when;
+}
+
 void clockintr()
 {
   acquire(&tickslock);
-  ticks++;
-  update_time();
-  // for (struct proc *p = proc; p < &proc[NPROC]; p++)
-  // {
-  //   acquire(&p->lock);
-  //   if (p->state == RUNNING)
-  //   {
-  //     printf("here");
-  //     p->rtime++;
-  //   }
-  //   // if (p->state == SLEEPING)
-  //   // {
-  //   //   p->wtime++;
-  //   // }
-  //   release(&p->lock);
-  // }
-  wakeup(&ticks);
+  updateticks();
+  if (ticks >= nextwake)
+    wheelexpire();
   release(&tickslock);
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
-// 1 if other device,
+// returns 2 if timer interrupt that ends the time slice,
+// 1 if other device (or another timer interrupt),
 // 0 if not recognized.
 int devintr()
 {
@@ -257,19 +369,33 @@ int devintr()
   }
   else if (scause == 0x8000000000000001L)
   {
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
-
-    if (cpuid() == 0)
-    {
-      clockintr();
-    }
+    // software interrupt from a one-shot machine-mode timer
+    // interrupt, forwarded by timervec in kernelvec.S.
 
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip. do this before re-arming the
+    // timer, so that a deadline that has already passed
+    // raises a fresh interrupt rather than being lost.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    clockintr();
+
+    // only preempt once the time slice is used up; the
+    // interrupt may have been for a sleep() deadline.
+    // scheduler() starts a fresh slice on the next dispatch.
+    // a runnable EDF process with budget left preempts
+    // round-robin ones (and later-deadline EDF ones).
+    struct cpu *c = mycpu();
+    int which = 1;
+    if ((c->slice_end && r_time() >= c->slice_end) ||
+        (c->proc && edfpreempt()))
+    {
+      c->slice_end = 0;
+      which = 2;
+    }
+    timerset();
+
+    return which;
   }
   else
   {
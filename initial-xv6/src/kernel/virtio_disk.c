@@ -41,6 +41,7 @@ static struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  int unkicked;    // submitted requests the device hasn't been told of?
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
@@ -212,26 +213,13 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// hand the disk a request for b in the three descriptors idx.
+// caller holds vdisk_lock.
+static void
+virtio_disk_submit(struct buf *b, int write, int *idx)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
-
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
@@ -276,21 +264,83 @@ virtio_disk_rw(struct buf *b, int write)
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
 
-  __sync_synchronize();
+  disk.unkicked = 1;
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// tell the device about the requests submitted since the
+// last notification. caller holds vdisk_lock.
+static void
+virtio_disk_notify(void)
+{
+  if(disk.unkicked){
+    __sync_synchronize();
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+    disk.unkicked = 0;
+  }
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// queue a request for b, without telling the device about it
+// yet: callers batch several requests and then call
+// virtio_disk_kick(). virtio_disk_intr() calls b->done when
+// the request finishes, or wakes up virtio_disk_wait(b).
+// if all descriptors are in use, returns -1 having queued
+// nothing if nowait is set, and otherwise waits for some.
+int
+virtio_disk_start(struct buf *b, int write, int nowait)
+{
+  int idx[3];
+
+  acquire(&disk.vdisk_lock);
+
+  // the spec's Section 5.2 says that legacy block operations use
+  // three descriptors: one for type/reserved/sector, one for the
+  // data, one for a 1-byte status result.
+
+  // allocate the three descriptors.
+  while(alloc3_desc(idx) < 0){
+    if(nowait){
+      release(&disk.vdisk_lock);
+      return -1;
+    }
+    // make sure the requests holding the descriptors
+    // are under way before waiting for them.
+    virtio_disk_notify();
+    sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  virtio_disk_submit(b, write, idx);
+  release(&disk.vdisk_lock);
+  return 0;
+}
+
+// one QUEUE_NOTIFY for all requests queued so far.
+void
+virtio_disk_kick(void)
+{
+  acquire(&disk.vdisk_lock);
+  virtio_disk_notify();
+  release(&disk.vdisk_lock);
+}
 
+// wait for the request for b, which has no b->done, to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  while(b->disk == 1) {
+    sleep(b, &disk.vdisk_lock);
+  }
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(b, write, 0);
+  virtio_disk_kick();
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -317,8 +367,16 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
+    disk.info[id].b = 0;
+    free_chain(id);
     b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    if(b->done){
+      void (*done)(struct buf*) = b->done;
+      b->done = 0;
+      done(b);
+    } else {
+      wakeup(b);
+    }
 
     disk.used_idx += 1;
   }
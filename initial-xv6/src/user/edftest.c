@@ -0,0 +1,152 @@
+// Test the EDF real-time class: a periodic task must finish
+// each job within its period while CPU-bound processes keep
+// every hart busy. Runs the task once as a round-robin
+// process and once with setdeadline(), and counts the jobs
+// that missed their deadline in each case.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NLOAD 8    // background CPU hogs
+#define PERIOD 5   // ticks
+#define BUDGET 3   // ticks of CPU per period
+#define WORK 2     // ticks of CPU each job needs
+#define NJOBS 20
+
+int loops_per_tick;
+
+void
+spin(int n)
+{
+  for(volatile int i = 0; i < n; i++)
+    ;
+}
+
+// count how many spin() iterations fit in one tick,
+// while the machine is still quiet.
+void
+calibrate(void)
+{
+  int t0, n;
+
+  t0 = uptime();
+  while(uptime() == t0)
+    ;
+  t0 = uptime();
+  for(n = 0; uptime() == t0; n += 10000)
+    spin(10000);
+  loops_per_tick = n;
+}
+
+// run NJOBS periodic jobs and return how many missed.
+int
+periodic(int rt)
+{
+  int i, start, release, misses = 0;
+
+  if(rt && setdeadline(PERIOD, BUDGET) < 0){
+    printf("edftest: setdeadline refused\n");
+    exit(1);
+  }
+  start = uptime();
+  for(i = 0; i < NJOBS; i++){
+    release = start + i * PERIOD;
+    if(uptime() < release)
+      sleep(release - uptime());
+    spin(WORK * loops_per_tick);
+    if(uptime() > release + PERIOD)
+      misses++;
+  }
+  return misses;
+}
+
+int
+run(int rt)
+{
+  int pids[NLOAD], i, pid, status;
+
+  for(i = 0; i < NLOAD; i++){
+    if((pids[i] = fork()) < 0){
+      printf("edftest: fork failed\n");
+      exit(1);
+    }
+    if(pids[i] == 0)
+      for(;;)
+        spin(1000000);
+  }
+
+  if((pid = fork()) == 0)
+    exit(periodic(rt));
+  // the hogs never exit on their own, so this is the task.
+  if(wait(&status) != pid){
+    printf("edftest: wait failed\n");
+    exit(1);
+  }
+
+  for(i = 0; i < NLOAD; i++)
+    kill(pids[i]);
+  for(i = 0; i < NLOAD; i++)
+    wait(0);
+  return status;
+}
+
+// Have this process and a child each ask for budget ticks out
+// of every period; return how many were admitted.
+int
+admit2(int period, int budget)
+{
+  int fds[2], pid, n;
+  char c;
+
+  if(pipe(fds) < 0)
+    return -1;
+  pid = fork();
+  if(pid < 0)
+    return -1;
+  if(pid == 0){
+    close(fds[0]);
+    c = setdeadline(period, budget) == 0;
+    write(fds[1], &c, 1);
+    sleep(1000);   // stay admitted until the parent kills us
+    exit(0);
+  }
+  close(fds[1]);
+  read(fds[0], &c, 1);
+  n = c;
+  n += setdeadline(period, budget) == 0;
+  setdeadline(0, 0);
+  kill(pid);
+  wait(0);
+  close(fds[0]);
+  return n;
+}
+
+int
+main(void)
+{
+  int rr, edf;
+
+  calibrate();
+
+  // admission control: more than 90% of a CPU is refused,
+  // whether asked for at once or by two processes.
+  if(setdeadline(10, 10) == 0){
+    printf("edftest: admission control failed\n");
+    exit(1);
+  }
+  if(admit2(10, 5) != 1){
+    printf("edftest: admission control failed to refuse overcommit\n");
+    exit(1);
+  }
+
+  rr = run(0);
+  edf = run(1);
+  printf("edftest: %d jobs, deadline misses: round-robin %d, edf %d\n",
+         NJOBS, rr, edf);
+  if(edf > 0)
+    printf("edftest: FAILED\n");
+  else
+    printf("edftest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,92 @@
+// Pipeline throughput with and without gang scheduling:
+// times N runs of "cat README | grep x | wc", first as plain
+// processes and then as a gang (see setgang()).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define N 20
+
+char *catargv[] = { "cat", "README", 0 };
+char *grepargv[] = { "grep", "x", 0 };
+char *wcargv[] = { "wc", 0 };
+
+// run argv with fd in as stdin and fd out as stdout.
+void
+stage(char **argv, int in, int out)
+{
+  if(fork() == 0){
+    if(in != 0){
+      close(0);
+      dup(in);
+    }
+    if(out != 1){
+      close(1);
+      dup(out);
+    }
+    for(int fd = 3; fd < 10; fd++)
+      close(fd);
+    exec(argv[0], argv);
+    printf("gangtest: exec %s failed\n", argv[0]);
+    exit(1);
+  }
+}
+
+void
+pipeline(int out)
+{
+  int p1[2], p2[2];
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf("gangtest: pipe failed\n");
+    exit(1);
+  }
+  stage(catargv, 0, p1[1]);
+  stage(grepargv, p1[0], p2[1]);
+  stage(wcargv, p2[0], out);
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+  close(p2[1]);
+  wait(0);
+  wait(0);
+  wait(0);
+}
+
+// time N pipelines in a child, optionally as a gang.
+int
+run(int gang)
+{
+  int fd, t0, i, status;
+
+  if(fork() == 0){
+    if(gang)
+      setgang();
+    if((fd = open("gangtest.out", O_CREATE|O_WRONLY|O_TRUNC)) < 0){
+      printf("gangtest: cannot create gangtest.out\n");
+      exit(-1);
+    }
+    t0 = uptime();
+    for(i = 0; i < N; i++)
+      pipeline(fd);
+    close(fd);
+    exit(uptime() - t0);
+  }
+  wait(&status);
+  return status;
+}
+
+int
+main(void)
+{
+  int plain, gang;
+
+  plain = run(0);
+  gang = run(1);
+  unlink("gangtest.out");
+  printf("gangtest: %d pipelines: %d ticks plain, %d ticks as a gang\n",
+         N, plain, gang);
+  exit(0);
+}
@@ -0,0 +1,56 @@
+// Pipe ping-pong benchmark: a parent and child bounce one
+// byte back and forth through two pipes, so every round trip
+// is two sleep()/wakeup() pairs. Type ^P before and after a
+// run to see how many processes wakeup() had to examine.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define N 10000
+
+int
+main(int argc, char *argv[])
+{
+  int p2c[2], c2p[2];
+  int i, n, t0, t1;
+  char c = 'x';
+
+  n = argc > 1 ? atoi(argv[1]) : N;
+  if(pipe(p2c) < 0 || pipe(c2p) < 0){
+    printf("pingpong: pipe failed\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  int pid = fork();
+  if(pid < 0){
+    printf("pingpong: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p2c[1]);
+    close(c2p[0]);
+    for(i = 0; i < n; i++){
+      if(read(p2c[0], &c, 1) != 1)
+        exit(1);
+      if(write(c2p[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+
+  close(p2c[0]);
+  close(c2p[1]);
+  for(i = 0; i < n; i++){
+    if(write(p2c[1], &c, 1) != 1 || read(c2p[0], &c, 1) != 1){
+      printf("pingpong: round trip %d failed\n", i);
+      exit(1);
+    }
+  }
+  wait(0);
+  t1 = uptime();
+
+  printf("pingpong: %d round trips in %d ticks\n", n, t1 - t0);
+  exit(0);
+}
@@ -0,0 +1,73 @@
+// Print the per-CPU scheduler histograms.
+//   schedstat            totals since boot
+//   schedstat cmd args   only what happened while cmd ran
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/schedstat.h"
+#include "user/user.h"
+
+struct schedstat before[NCPU], after[NCPU];
+
+void
+snapshot(struct schedstat *st)
+{
+  for(int cpu = 0; cpu < NCPU; cpu++)
+    if(schedstat(cpu, &st[cpu]) < 0){
+      printf("schedstat: cannot read cpu %d\n", cpu);
+      exit(1);
+    }
+}
+
+// print the non-empty buckets of one histogram as
+// log2(cycles):count.
+void
+phist(char *name, uint64 *a, uint64 *b)
+{
+  int i;
+
+  printf("  %s:", name);
+  for(i = 0; i < NSCHEDHIST; i++){
+    int d = b[i] - a[i];
+    if(d)
+      printf(" %d:%d", i, d);
+  }
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct schedstat *a, *b;
+
+  if(argc > 1){
+    snapshot(before);
+    int pid = fork();
+    if(pid < 0){
+      printf("schedstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      printf("schedstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  snapshot(after);
+
+  printf("log2(cycles):count, %d cycles per tick\n", TICKINTERVAL);
+  for(int cpu = 0; cpu < NCPU; cpu++){
+    a = &before[cpu];
+    b = &after[cpu];
+    if(memcmp(a, b, sizeof(*a)) == 0)
+      continue;
+    printf("cpu %d\n", cpu);
+    phist("latency", a->latency, b->latency);
+    phist("slice", a->slice, b->slice);
+    phist("swtch", a->swtch, b->swtch);
+    phist("idle", a->idle, b->idle);
+  }
+  exit(0);
+}
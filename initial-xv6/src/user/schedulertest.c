@@ -1,16 +1,26 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/rusage.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
 
 #define NFORK 10
 #define IO 5
 
+// print cycles as ticks with one decimal place.
+void pticks(char *what, uint64 cycles)
+{
+  uint64 t = cycles / (TICKINTERVAL / 10);
+  printf(" %s %d.%d", what, (int)(t / 10), (int)(t % 10));
+}
+
 int main()
 {
   int n, pid;
   int wtime, rtime;
   int twtime = 0, trtime = 0;
+  struct rusage ru;
   for (n = 0; n < NFORK; n++)
   {
     pid = fork();
@@ -34,12 +44,21 @@ int main()
   }
   for (; n > 0; n--)
   {
-    if (waitx(0, &wtime, &rtime) >= 0)
+    if ((pid = waitx2(0, &ru)) >= 0)
     {
+      rtime = (ru.utime + ru.ktime) / TICKINTERVAL;
+      wtime = (ru.wtime + ru.stime) / TICKINTERVAL;
       trtime += rtime;
       twtime += wtime;
+      printf("pid %d:", pid);
+      pticks("user", ru.utime);
+      pticks("kernel", ru.ktime);
+      pticks("runnable", ru.wtime);
+      pticks("sleep", ru.stime);
+      printf(" vcsw %d ivcsw %d cow %d bread %d\n",
+             ru.nvcsw, ru.nivcsw, ru.ncow, ru.nbread);
     }
   }
   printf("Average rtime %d,  wtime %d\n", trtime / NFORK, twtime / NFORK);
   exit(0);
-}
\ No newline at end of file
+}
@@ -100,6 +100,7 @@ runcmd(struct cmd *cmd)
 
   case PIPE:
     pcmd = (struct pipecmd*)cmd;
+    setgang();  // run the stages side by side on different harts
     if(pipe(p) < 0)
       panic("pipe");
     if(fork1() == 0){
@@ -1,4 +1,6 @@
 struct stat;
+struct rusage;
+struct schedstat;
 
 // system calls
 int fork(void);
@@ -23,6 +25,11 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int waitx(int*, int* /*wtime*/, int* /*rtime*/);
+int waitx2(int*, struct rusage*);
+int setdeadline(int /*period*/, int /*budget*/);
+int setgang(void);
+int schedstat(int, struct schedstat*);
+int splice(int, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -18,6 +18,9 @@
 //
 
 #define BUFSZ  ((MAXOPBLOCKS+2)*BSIZE)
+// MAXFILE no longer fits on the disk; go well into the
+// double-indirect blocks instead.
+#define BIGFILE (NDIRECT + NINDIRECT + 2*NINDIRECT + 1)
 
 char buf[BUFSZ];
 
@@ -586,7 +589,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGFILE; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +609,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGFILE){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -786,6 +789,78 @@ pipe1(char *s)
 }
 
 
+// splice() a file into a pipe in one process and the pipe
+// into another file in a second, then check the copy.
+void
+splicetest(char *s)
+{
+  int fds[2], fd, pid, xstatus;
+  int i, n, tot;
+  enum { SZ=3*4096+123 };
+
+  fd = open("splicein", O_CREATE|O_RDWR|O_TRUNC);
+  if(fd < 0){
+    printf("%s: create splicein failed\n", s);
+    exit(1);
+  }
+  for(tot = 0; tot < SZ; tot += n){
+    n = SZ - tot < sizeof(buf) ? SZ - tot : sizeof(buf);
+    for(i = 0; i < n; i++)
+      buf[i] = (tot + i) % 251;
+    if(write(fd, buf, n) != n){
+      printf("%s: write splicein failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splicein", O_RDONLY);
+    while((n = splice(fd, fds[1], 5000)) > 0)
+      ;
+    exit(n == 0 ? 0 : 1);
+  }
+  close(fds[1]);
+  fd = open("spliceout", O_CREATE|O_RDWR|O_TRUNC);
+  tot = 0;
+  while((n = splice(fds[0], fd, 4096)) > 0)
+    tot += n;
+  close(fds[0]);
+  close(fd);
+  wait(&xstatus);
+  if(n < 0 || xstatus != 0 || tot != SZ){
+    printf("%s: splice moved %d of %d bytes\n", s, tot, SZ);
+    exit(1);
+  }
+
+  fd = open("spliceout", O_RDONLY);
+  for(tot = 0; (n = read(fd, buf, sizeof(buf))) > 0; tot += n){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (tot + i) % 251){
+        printf("%s: wrong byte at %d\n", s, tot + i);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  if(tot != SZ){
+    printf("%s: spliceout has %d bytes\n", s, tot);
+    exit(1);
+  }
+  unlink("splicein");
+  unlink("spliceout");
+}
+
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -2594,6 +2669,7 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {splicetest, "splicetest"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -36,4 +36,9 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
-entry("waitx");
\ No newline at end of file
+entry("waitx");
+entry("waitx2");
+entry("setdeadline");
+entry("setgang");
+entry("schedstat");
+entry("splice");